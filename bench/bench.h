@@ -0,0 +1,32 @@
+#pragma once
+
+#include "gpapi.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// \brief Helpers shared by the benchmarks. Times are in milliseconds of InitTimer::now()
+namespace bench {
+    /// \return The best time of reps calls of run(), after one warm-up call
+    template <typename RUN>
+    double bestTime(RUN& run, int reps) {
+        run();
+        double best = 0;
+        for (int i = 0; i < reps; ++i) {
+            const double start = GPAPI::InitTimer::now();
+            run();
+            const double time = GPAPI::InitTimer::now() - start;
+            best = i ? std::min(best, time) : time;
+        }
+        return best;
+    }
+
+    /// \return The native device of initGPAPI (the source is not used on the native target)
+    inline std::vector<GPAPI::Device*> initDevices() {
+        std::vector<GPAPI::Device*> devices;
+        GPAPI::initGPAPI(devices, std::string());
+        return devices;
+    }
+}
@@ -0,0 +1,123 @@
+#include "bench.h"
+
+using namespace GPAPI;
+
+/*! A chunked copy-in / kernel / copy-out pipeline (blend4 of kernel.cl), run with blocking transfers and with uploadAsync / downloadAsync.
+ The async run puts the chunks on two queues, so the transfers of one chunk overlap the kernel of the other. On the native target the copies run on the copy thread, so the overlap needs a spare core
+ */
+namespace {
+    const unsigned int CHUNK_ITEMS = 256 * 1024;
+    const int NUM_CHUNKS = 8;
+    const int NUM_QUEUES = 2;
+    const int REPS = 5;
+    const float T = 0.25f;
+
+    /// Host arrays of all the chunks and the device buffers of each chunk
+    struct Pipeline {
+        Device* device;
+        std::vector<float> a, b, out;
+        Buffer deviceA[NUM_CHUNKS], deviceB[NUM_CHUNKS], deviceOut[NUM_CHUNKS];
+
+        size_t chunkBytes() const {
+            return CHUNK_ITEMS * 4 * sizeof(float);
+        }
+
+        float* chunk(std::vector<float>& host, int c) {
+            return &host[(size_t)c * CHUNK_ITEMS * 4];
+        }
+
+        void bind(int c) {
+            device->setParam(0, &deviceA[c]);
+            device->setParam(1, &deviceB[c]);
+            device->setParam(2, &deviceOut[c]);
+        }
+    };
+
+    /// Each transfer and launch blocks until it is done
+    struct RunBlocking {
+        Pipeline* pipeline;
+        void operator()() {
+            Pipeline& p = *pipeline;
+            Device& device = *p.device;
+            for (int c = 0; c < NUM_CHUNKS; ++c) {
+                p.deviceA[c].uploadAsync(device.getQueue(), device.getContext(), p.chunk(p.a, c), p.chunkBytes()).wait();
+                p.deviceB[c].uploadAsync(device.getQueue(), device.getContext(), p.chunk(p.b, c), p.chunkBytes()).wait();
+                p.bind(c);
+                device.launchKernel(CHUNK_ITEMS, 0).wait();
+                p.deviceOut[c].download(device.getQueue(), device.getContext(), p.chunk(p.out, c), p.chunkBytes());
+            }
+        }
+    };
+
+    /// Everything is enqueued with events, chunk c on queue c % NUM_QUEUES, and waited for at the end
+    struct RunAsync {
+        Pipeline* pipeline;
+        void operator()() {
+            Pipeline& p = *pipeline;
+            Device& device = *p.device;
+            Events downloads;
+            for (int c = 0; c < NUM_CHUNKS; ++c) {
+                const int queue = c % NUM_QUEUES;
+                Events uploads;
+                uploads.push_back(p.deviceA[c].uploadAsync(device.getQueue(queue), device.getContext(), p.chunk(p.a, c), p.chunkBytes()));
+                uploads.push_back(p.deviceB[c].uploadAsync(device.getQueue(queue), device.getContext(), p.chunk(p.b, c), p.chunkBytes()));
+                p.bind(c);
+                Events launch;
+                launch.push_back(device.launchKernel(CHUNK_ITEMS, 0, uploads, queue));
+                downloads.push_back(p.deviceOut[c].downloadAsync(device.getQueue(queue), device.getContext(), p.chunk(p.out, c), p.chunkBytes(), launch));
+            }
+            for (size_t i = 0; i < downloads.size(); ++i)
+                downloads[i].wait();
+        }
+    };
+}
+
+int main() {
+    std::vector<Device*> devices = bench::initDevices();
+    Device& device = *devices[0];
+    device.setNumQueues(NUM_QUEUES);
+
+    Pipeline pipeline;
+    pipeline.device = &device;
+    const size_t floats = (size_t)NUM_CHUNKS * CHUNK_ITEMS * 4;
+    pipeline.a.resize(floats);
+    pipeline.b.resize(floats);
+    for (size_t i = 0; i < floats; ++i) {
+        pipeline.a[i] = 1.0f + i % 7;
+        pipeline.b[i] = 2.0f - i % 5;
+    }
+    for (int c = 0; c < NUM_CHUNKS; ++c) {
+        pipeline.deviceA[c].init(device.getQueue(), device.getContext(), NULL, pipeline.chunkBytes());
+        pipeline.deviceB[c].init(device.getQueue(), device.getContext(), NULL, pipeline.chunkBytes());
+        pipeline.deviceOut[c].init(device.getQueue(), device.getContext(), NULL, pipeline.chunkBytes());
+    }
+    device.setKernel("blend4");
+    device.addParam(&pipeline.deviceA[0]);
+    device.addParam(&pipeline.deviceB[0]);
+    device.addParam(&pipeline.deviceOut[0]);
+    device.addParam(T);
+    device.addParam(CHUNK_ITEMS);
+
+    RunBlocking blocking = { &pipeline };
+    pipeline.out.assign(floats, 0);
+    const double blockingTime = bench::bestTime(blocking, REPS);
+    const std::vector<float> blockingOut = pipeline.out;
+
+    RunAsync async = { &pipeline };
+    pipeline.out.assign(floats, 0);
+    const double asyncTime = bench::bestTime(async, REPS);
+    const bool same = pipeline.out == blockingOut;
+
+    printf("blend4, %i chunks of %u items, best of %i runs, %i threads\n", NUM_CHUNKS, CHUNK_ITEMS, REPS, (int)device.getThreadsPerBlock());
+    printf("blocking transfers: %.1f ms\n", blockingTime);
+    printf("async transfers:    %.1f ms%s\n", asyncTime, same ? "" : " (results differ)");
+
+    for (int c = 0; c < NUM_CHUNKS; ++c) {
+        pipeline.deviceA[c].freeMem();
+        pipeline.deviceB[c].freeMem();
+        pipeline.deviceOut[c].freeMem();
+    }
+    device.freeMem();
+    freeGPAPI(devices);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include "bench.h"
+
+using namespace GPAPI;
+
+/*! Native kernels with FOR_EACH_ITEM, that run a whole chunk in one loop, against the same kernels called once per work item:
+ vecAdd / vecAddPerItem and the float4 kernels blend4 / blend4PerItem of kernel.cl
+ */
+namespace {
+    const int REPS = 10;
+    const unsigned int GROUP_SIZE = 64;
+
+    struct Launch {
+        Device* device;
+        size_t items;
+        void operator()() {
+            device->launchKernel(items, GROUP_SIZE);
+            device->wait();
+        }
+    };
+
+    /// \return Best time of kernelName on vecAdd's arguments, result gets its output
+    double timeVecAdd(Device& device, const char* kernelName, unsigned int n, std::vector<int>& result) {
+        std::vector<int> a(n), b(n);
+        for (unsigned int i = 0; i < n; ++i) {
+            a[i] = i;
+            b[i] = 2 * i;
+        }
+        result.resize(n);
+        device.setKernel(kernelName);
+        device.addParam(&a[0], n * sizeof(int));
+        device.addParam(&b[0], n * sizeof(int));
+        Buffer& out = device.addParam(NULL, n * sizeof(int));
+        device.addParam(n);
+        Launch launch = { &device, n };
+        const double time = bench::bestTime(launch, REPS);
+        out.download(device.getQueue(), device.getContext(), &result[0], n * sizeof(int));
+        device.freeMem();
+        return time;
+    }
+
+    /// \return Best time of kernelName on blend4's arguments, result gets its output
+    double timeBlend4(Device& device, const char* kernelName, unsigned int n, std::vector<float>& result) {
+        std::vector<float> a(4 * n), b(4 * n);
+        for (unsigned int i = 0; i < 4 * n; ++i) {
+            a[i] = 1.0f + i % 7;
+            b[i] = 2.0f - i % 5;
+        }
+        result.resize(4 * n);
+        const size_t bytes = 4 * n * sizeof(float);
+        device.setKernel(kernelName);
+        device.addParam(&a[0], bytes);
+        device.addParam(&b[0], bytes);
+        Buffer& out = device.addParam(NULL, bytes);
+        device.addParam(0.25f);
+        device.addParam(n);
+        Launch launch = { &device, n };
+        const double time = bench::bestTime(launch, REPS);
+        out.download(device.getQueue(), device.getContext(), &result[0], bytes);
+        device.freeMem();
+        return time;
+    }
+
+    void print(const char* name, unsigned int n, double perItem, double looped, bool same) {
+        printf("%-8s %8u items: per item %8.2f ms, FOR_EACH_ITEM %8.2f ms, %5.2fx%s\n", name, n, perItem, looped, perItem / looped, same ? "" : " (results differ)");
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = bench::initDevices();
+    Device& device = *devices[0];
+    printf("best of %i launches on %i threads\n", REPS, (int)device.getThreadsPerBlock());
+
+    const unsigned int vecAddItems = 4096;
+    std::vector<int> perItemSums, loopedSums;
+    const double vecAddPerItem = timeVecAdd(device, "vecAddPerItem", vecAddItems, perItemSums);
+    const double vecAdd = timeVecAdd(device, "vecAdd", vecAddItems, loopedSums);
+    print("vecAdd", vecAddItems, vecAddPerItem, vecAdd, perItemSums == loopedSums);
+
+    const unsigned int blendItems = 1024 * 1024;
+    std::vector<float> perItemBlend, loopedBlend;
+    const double blendPerItem = timeBlend4(device, "blend4PerItem", blendItems, perItemBlend);
+    const double blend = timeBlend4(device, "blend4", blendItems, loopedBlend);
+    print("blend4", blendItems, blendPerItem, blend, perItemBlend == loopedBlend);
+
+    freeGPAPI(devices);
+    const bool same = perItemSums == loopedSums && perItemBlend == loopedBlend;
+    return same ? 0 : 1;
+}
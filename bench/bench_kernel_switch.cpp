@@ -0,0 +1,123 @@
+#include "bench.h"
+
+using namespace GPAPI;
+
+/*! A pipeline, that alternates two kernels: vecAdd and a vecAddPerItem of its output (both without barriers, so the native target runs no fibers).
+ With the kernel cache of Device, setKernel only switches back and the arguments stay bound. The other run creates both kernels and binds their arguments again on every switch, as a device with a single kernel slot had to.
+ The launches are small and both runs wait for each of them, so the difference is the cost of creating and binding the kernels
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 256;
+    const unsigned int GROUP_SIZE = 64;
+    const int ITERATIONS = 2000;
+    const int REPS = 3;
+
+    struct Buffers {
+        Buffer a, b, c, d;
+    };
+
+    void bindVecAdd(Device& device, Buffers& buffers) {
+        device.setKernel("vecAdd");
+        device.addParam(&buffers.a);
+        device.addParam(&buffers.b);
+        device.addParam(&buffers.c);
+        device.addParam(NUM_ITEMS);
+    }
+
+    void bindVecAddPerItem(Device& device, Buffers& buffers) {
+        device.setKernel("vecAddPerItem");
+        device.addParam(&buffers.c);
+        device.addParam(&buffers.b);
+        device.addParam(&buffers.d);
+        device.addParam(NUM_ITEMS);
+    }
+
+    void launch(Device& device) {
+        device.launchKernel(NUM_ITEMS, GROUP_SIZE);
+        device.wait();
+    }
+
+    /// \return ms per iteration. Each kernel is bound once, later iterations only switch
+    double runCached(Device& device, Buffers& buffers) {
+        bindVecAdd(device, buffers);
+        bindVecAddPerItem(device, buffers);
+        const double start = InitTimer::now();
+        for (int i = 0; i < ITERATIONS; ++i) {
+            device.setKernel("vecAdd");
+            launch(device);
+            device.setKernel("vecAddPerItem");
+            launch(device);
+        }
+        const double time = (InitTimer::now() - start) / ITERATIONS;
+        device.freeMem();
+        return time;
+    }
+
+    /// \return ms per iteration. Every switch drops the kernels and creates and binds the next one again
+    double runRebound(Device& device, Buffers& buffers) {
+        const double start = InitTimer::now();
+        for (int i = 0; i < ITERATIONS; ++i) {
+            device.freeMem();
+            bindVecAdd(device, buffers);
+            launch(device);
+            device.freeMem();
+            bindVecAddPerItem(device, buffers);
+            launch(device);
+        }
+        const double time = (InitTimer::now() - start) / ITERATIONS;
+        device.freeMem();
+        return time;
+    }
+
+    /// \return Number of wrong outputs of the last iteration
+    int countBad(Device& device, Buffers& buffers, const std::vector<int>& a, const std::vector<int>& b) {
+        std::vector<int> d(NUM_ITEMS);
+        buffers.d.download(device.getQueue(), device.getContext(), &d[0], NUM_ITEMS * sizeof(int));
+        int bad = 0;
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            bad += d[i] != a[i] + 2 * (1 + b[i]);
+        return bad;
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = bench::initDevices();
+    Device& device = *devices[0];
+    std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS);
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+        a[i] = i;
+        b[i] = 3;
+    }
+    const size_t bytes = NUM_ITEMS * sizeof(int);
+    int bad = 0;
+    double cached = 0, rebound = 0;
+    {
+        Buffers buffers;
+        buffers.a.init(device.getQueue(), device.getContext(), &a[0], bytes);
+        buffers.b.init(device.getQueue(), device.getContext(), &b[0], bytes);
+        buffers.c.init(device.getQueue(), device.getContext(), NULL, bytes);
+        buffers.d.init(device.getQueue(), device.getContext(), NULL, bytes);
+        //alternated, so both see the same state of the machine. The first pair is a warm-up
+        for (int rep = 0; rep <= REPS; ++rep) {
+            const double reboundTime = runRebound(device, buffers);
+            bad += countBad(device, buffers, a, b);
+            const double cachedTime = runCached(device, buffers);
+            bad += countBad(device, buffers, a, b);
+            if (rep == 1 || (rep > 1 && reboundTime < rebound))
+                rebound = reboundTime;
+            if (rep == 1 || (rep > 1 && cachedTime < cached))
+                cached = cachedTime;
+        }
+        buffers.a.freeMem();
+        buffers.b.freeMem();
+        buffers.c.freeMem();
+        buffers.d.freeMem();
+    }
+    printf("vecAdd + vecAddPerItem over %u items, best of %i runs of %i iterations\n", NUM_ITEMS, REPS, ITERATIONS);
+    printf("kernels bound again on each switch: %.1f us per iteration\n", rebound * 1000);
+    printf("cached kernels:                     %.1f us per iteration\n", cached * 1000);
+    if (bad)
+        printf("%i wrong outputs\n", bad);
+    freeGPAPI(devices);
+    return bad != 0;
+}
@@ -0,0 +1,51 @@
+#include "bench.h"
+
+using namespace GPAPI;
+
+/*! An alloc/free-heavy loop: each iteration sets a kernel, adds buffers of 4 KB, 64 KB and 1 MB and frees them with freeMem.
+ It runs with the memory pool disabled (setMaxCachedBytes(0), every buffer goes to the allocator) and enabled
+ */
+namespace {
+    const int ITERATIONS = 20000;
+    const int REPS = 3;
+
+    struct AllocFree {
+        Device* device;
+        void operator()() {
+            const size_t sizes[] = { 4096, 64 * 1024, 1024 * 1024 + 100 };
+            for (int i = 0; i < ITERATIONS; ++i) {
+                device->setKernel("vecAdd");
+                for (int s = 0; s < 3; ++s) {
+                    Buffer& buffer = device->addParam(NULL, sizes[s]);
+                    //touch the memory, so an allocation really maps its pages
+                    ((char*)buffer.get())[0] = 1;
+                    ((char*)buffer.get())[sizes[s] - 1] = 1;
+                }
+                device->addParam(0);
+                device->freeMem();
+            }
+        }
+    };
+}
+
+int main() {
+    std::vector<Device*> devices = bench::initDevices();
+    Device& device = *devices[0];
+    MemoryPool& pool = device.getMemoryPool();
+    AllocFree loop = { &device };
+
+    pool.setMaxCachedBytes(0);
+    const double direct = bench::bestTime(loop, REPS);
+    pool.setMaxCachedBytes(MemoryPool::DEFAULT_MAX_CACHED_BYTES);
+    const MemoryPool::Stats before = pool.getStats();
+    const double pooled = bench::bestTime(loop, REPS);
+    const MemoryPool::Stats& stats = pool.getStats();
+
+    printf("%i iterations of 3 buffers, best of %i runs\n", ITERATIONS, REPS);
+    printf("without the pool: %.3f us per iteration\n", direct * 1000 / ITERATIONS);
+    printf("with the pool:    %.3f us per iteration\n", pooled * 1000 / ITERATIONS);
+    printf("pooled runs: %u hits, %u misses, %u bytes cached, %u bytes in use\n", (unsigned)(stats.hits - before.hits), (unsigned)(stats.misses - before.misses), (unsigned)stats.bytesCached, (unsigned)stats.bytesInUse);
+
+    freeGPAPI(devices);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "bench.h"
+
+using namespace GPAPI;
+
+/*! Transfer bandwidth from and to pageable host memory (std::vector) and pinned HostBuffer memory.
+ On CUDA and OpenCL the driver copies pinned memory directly, on the native target HostBuffer is an aligned (huge page) allocation
+ */
+namespace {
+    const size_t BYTES = size_t(64) * 1024 * 1024;
+    const int REPS = 10;
+
+    struct Transfer {
+        Device* device;
+        Buffer* buffer;
+        void* host;
+        bool upload;
+        void operator()() {
+            if (upload)
+                buffer->uploadAsync(device->getQueue(), device->getContext(), host, BYTES).wait();
+            else
+                buffer->download(device->getQueue(), device->getContext(), host, BYTES);
+        }
+    };
+
+    /// \return GB/s of the best of REPS transfers
+    double measure(Device& device, Buffer& buffer, void* host, bool upload) {
+        Transfer transfer = { &device, &buffer, host, upload };
+        return BYTES / bench::bestTime(transfer, REPS) / 1e6;
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = bench::initDevices();
+    Device& device = *devices[0];
+    std::vector<char> pageable(BYTES, 1);
+    HostBuffer pinned;
+    pinned.init(device.getQueue(), device.getContext(), BYTES);
+    memset(pinned.get(), 1, BYTES);
+    double uploadPageable, uploadPinned, downloadPageable, downloadPinned;
+    {
+        Buffer buffer;
+        buffer.init(device.getQueue(), device.getContext(), NULL, BYTES);
+        uploadPageable = measure(device, buffer, &pageable[0], true);
+        uploadPinned = measure(device, buffer, pinned.get(), true);
+        downloadPageable = measure(device, buffer, &pageable[0], false);
+        downloadPinned = measure(device, buffer, pinned.get(), false);
+    }
+    printf("%u MB transfers, best of %i\n", (unsigned)(BYTES >> 20), REPS);
+    printf("upload:   pageable %6.2f GB/s, pinned %6.2f GB/s\n", uploadPageable, uploadPinned);
+    printf("download: pageable %6.2f GB/s, pinned %6.2f GB/s\n", downloadPageable, downloadPinned);
+    pinned.freeMem();
+    freeGPAPI(devices);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "bench.h"
+
+#include <thread>
+
+using namespace GPAPI;
+
+/*! Scaling of native launches with the worker threads: the time of vecAdd over NUM_ITEMS items with 1, 2, 4... threads, up to the number of cores.
+ The thread pool is created once per process, so each thread count runs in a child process with GPAPI_NATIVE_THREADS set
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 8192;
+    const unsigned int GROUP_SIZE = 64;
+    const int REPS = 10;
+
+    struct LaunchVecAdd {
+        Device* device;
+        void operator()() {
+            device->launchKernel(NUM_ITEMS, GROUP_SIZE);
+            device->wait();
+        }
+    };
+
+    /// Times vecAdd on the pool of this process and prints "result <threads> <ms>"
+    int runChild() {
+        std::vector<Device*> devices = bench::initDevices();
+        Device& device = *devices[0];
+        std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS), c(NUM_ITEMS);
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+            a[i] = i;
+            b[i] = 2 * i;
+        }
+        const size_t bytes = NUM_ITEMS * sizeof(int);
+        device.setKernel("vecAdd");
+        device.addParam(&a[0], bytes);
+        device.addParam(&b[0], bytes);
+        Buffer& result = device.addParam(NULL, bytes);
+        device.addParam(NUM_ITEMS);
+        LaunchVecAdd launch = { &device };
+        const double time = bench::bestTime(launch, REPS);
+        result.download(device.getQueue(), device.getContext(), &c[0], bytes);
+        int bad = 0;
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            bad += c[i] != (int)(3 * i + 1);
+        printf("result %i %f %i\n", (int)device.getThreadsPerBlock(), time, bad);
+        freeGPAPI(devices);
+        return bad != 0;
+    }
+
+    /// Runs the child with threads workers. \return Its time in ms, a negative value if it failed
+    double runWithThreads(const char* self, int threads) {
+        char command[1024];
+#ifdef _WIN32
+        snprintf(command, sizeof(command), "set GPAPI_NATIVE_THREADS=%i&& \"%s\" --child", threads, self);
+        FILE* child = _popen(command, "r");
+#else
+        snprintf(command, sizeof(command), "GPAPI_NATIVE_THREADS=%i \"%s\" --child", threads, self);
+        FILE* child = popen(command, "r");
+#endif
+        if (!child)
+            return -1;
+        double time = -1;
+        char line[1024];
+        while (fgets(line, sizeof(line), child)) {
+            int reported, bad;
+            double ms;
+            if (sscanf(line, "result %i %lf %i", &reported, &ms, &bad) == 3 && reported == threads && !bad)
+                time = ms;
+        }
+#ifdef _WIN32
+        _pclose(child);
+#else
+        pclose(child);
+#endif
+        return time;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && !strcmp(argv[1], "--child"))
+        return runChild();
+
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    printf("vecAdd, %u items, best of %i launches, %i cores\n", NUM_ITEMS, REPS, cores);
+    printf("threads      ms  speedup  efficiency\n");
+    double single = 0;
+    for (int threads = 1; ; threads = std::min(threads * 2, cores)) {
+        const double time = runWithThreads(argv[0], threads);
+        if (time < 0) {
+            printf("%7i  failed\n", threads);
+            return 1;
+        }
+        if (threads == 1)
+            single = time;
+        printf("%7i %7.2f %8.2f %10.0f%%\n", threads, time, single / time, 100 * single / time / threads);
+        if (threads == cores)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "common.h"
+
+#ifndef __GPAPI_H__
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /// \brief How a kernel is launched: the work-group size, the kernel variant and, on the native target, the chunk size
+    struct LaunchConfig {
+        LaunchConfig():chunkSize(0) {
+        }
+
+        /// Work-group size, the empty NDRange() to pick it automatically
+        NDRange local;
+        /// Compile-time constants of the kernel variant (see Device::setKernel)
+        KernelDefines defines;
+        /// Work items of each native chunk (see KernelLaunch::chunkSize), 0 for the default
+        size_t chunkSize;
+
+        /// \return The config as text, for the log
+        std::string toString() const {
+            char text[128];
+            snprintf(text, sizeof(text), "local %ix%ix%i chunk %i", (int)local[0], (int)local[1], (int)local[2], (int)chunkSize);
+            const std::string defines = getDefinesKey(this->defines);
+            return defines.empty() ? text : std::string(text) + " defines '" + defines + "'";
+        }
+    };
+
+    /*! \brief The best launch config of each device model, kernel and problem size, kept in a text file between runs.
+     Each line is an entry: device name, kernel name, size bucket, the number of local dimensions, the 3 local sizes, the chunk size and the defines key, separated by tabs.
+     The file is written to a temporary name and renamed, and the entries of other processes, that were stored in the meantime, are kept.
+     */
+    struct TuningDatabase {
+        /// \param filePath The database file, it is read if it exists. If empty, the entries are only kept in memory
+        TuningDatabase(const std::string& filePath = std::string()):path(filePath) {
+            load(entries);
+        }
+
+        /// \return The key of an entry. Problem sizes are bucketed: each dimension is rounded up to a power of 2, so close sizes share the entry
+        static std::string makeKey(const std::string& deviceName, const std::string& kernelName, const NDRange& global) {
+            std::string bucket;
+            for (int i = 0; i < std::max(1, global.getDims()); ++i) {
+                size_t size = 1;
+                while (size < global[i])
+                    size *= 2;
+                char dim[32];
+                snprintf(dim, sizeof(dim), i ? "x%u" : "%u", (unsigned)size);
+                bucket += dim;
+            }
+            return deviceName + "\t" + kernelName + "\t" + bucket;
+        }
+
+        /// \return true and the config stored for key, if there is one
+        bool find(const std::string& key, LaunchConfig& config) const {
+            std::map<std::string, LaunchConfig>::const_iterator it = entries.find(key);
+            if (it == entries.end())
+                return false;
+            config = it->second;
+            return true;
+        }
+
+        /// Keeps config as the entry of key and writes the file. Write failures are only logged
+        void store(const std::string& key, const LaunchConfig& config) {
+            entries[key] = config;
+            if (path.empty())
+                return;
+            std::map<std::string, LaunchConfig> merged;
+            load(merged);
+            merged[key] = config;
+            entries.insert(merged.begin(), merged.end());
+
+            const std::string tmpPath = path + getTempSuffix();
+            FILE* file = fopen(tmpPath.c_str(), "w");
+            bool written = file != NULL;
+            for (std::map<std::string, LaunchConfig>::const_iterator it = merged.begin(); written && it != merged.end(); ++it) {
+                const LaunchConfig& entry = it->second;
+                written = fprintf(file, "%s\t%i\t%u\t%u\t%u\t%u\t%s\n", it->first.c_str(), entry.local.getDims(),
+                                  (unsigned)entry.local[0], (unsigned)entry.local[1], (unsigned)entry.local[2],
+                                  (unsigned)entry.chunkSize, getDefinesKey(entry.defines).c_str()) > 0;
+            }
+            if (file && fclose(file))
+                written = false;
+            if (!written || rename(tmpPath.c_str(), path.c_str())) {
+                printLog(LogTypeWarning, "could not write tuning database %s\n", path.c_str());
+                remove(tmpPath.c_str());
+            }
+        }
+
+        size_t size() const {
+            return entries.size();
+        }
+    private:
+        /// Adds the entries of the file to result. Lines, that can not be parsed, are skipped
+        void load(std::map<std::string, LaunchConfig>& result) const {
+            if (path.empty())
+                return;
+            std::ifstream file(path.c_str());
+            std::string line;
+            while (std::getline(file, line)) {
+                std::vector<std::string> fields;
+                size_t begin = 0;
+                for (size_t end; (end = line.find('\t', begin)) != std::string::npos; begin = end + 1)
+                    fields.push_back(line.substr(begin, end - begin));
+                fields.push_back(line.substr(begin));
+                if (fields.size() != 9)
+                    continue;
+                const int dims = atoi(fields[3].c_str());
+                const size_t x = strtoul(fields[4].c_str(), NULL, 10), y = strtoul(fields[5].c_str(), NULL, 10), z = strtoul(fields[6].c_str(), NULL, 10);
+                LaunchConfig config;
+                config.local = dims == 1 ? NDRange(x) : dims == 2 ? NDRange(x, y) : dims == 3 ? NDRange(x, y, z) : NDRange();
+                config.chunkSize = strtoul(fields[7].c_str(), NULL, 10);
+                config.defines = parseDefinesKey(fields[8]);
+                result[fields[0] + "\t" + fields[1] + "\t" + fields[2]] = config;
+            }
+        }
+
+        std::string path;
+        std::map<std::string, LaunchConfig> entries;
+    };
+
+    /// \brief One launch of a candidate config, that TuningTimer measures. run() launches the kernel and waits for it
+    struct TuningRun {
+        virtual void run() = 0;
+        virtual ~TuningRun() {
+        }
+    };
+
+    /*! \brief Measures how long the launch of a candidate takes, for Autotuner.
+     The default is the best wall time of REPEATS runs after a warm-up run. Subclasses can replace it, e.g. with profiling events or with fixed times in tests
+     */
+    struct TuningTimer {
+        enum { REPEATS = 3 };
+
+        /// \return Time of the launch of config in milliseconds
+        virtual double measure(const LaunchConfig& /*config*/, TuningRun& launch) {
+            launch.run();
+            double best = 0;
+            for (int i = 0; i < REPEATS; ++i) {
+                const double start = InitTimer::now();
+                launch.run();
+                const double time = InitTimer::now() - start;
+                best = i ? std::min(best, time) : time;
+            }
+            return best;
+        }
+
+        virtual ~TuningTimer() {
+        }
+    };
+
+    /*! \brief Picks the fastest launch config of a kernel on a device by timing candidates, and remembers it in a TuningDatabase.
+     The entry is found by the device name, the kernel name and the size bucket of the launch, so later runs on the same model reuse it without timing anything
+     */
+    struct Autotuner {
+        /// \param timer Measures the candidates. If NULL, a TuningTimer is used. It should outlive the tuner
+        Autotuner(TuningDatabase& tuningDatabase, TuningTimer* tuningTimer = NULL):database(tuningDatabase), timer(tuningTimer ? tuningTimer : &defaultTimer), measured(0) {
+        }
+
+        /*! \return Candidates for a launch of kernelName over global: the work-group sizes of chooseLocalSize with targets from the warp size to the largest group, for each of the variants.
+         The native target has no warps, its candidates are chunk sizes instead
+         */
+        static std::vector<LaunchConfig> makeCandidates(Device& device, const std::string& kernelName, const NDRange& global, const std::vector<KernelDefines>& variants = std::vector<KernelDefines>(1)) {
+            std::vector<LaunchConfig> candidates;
+            for (size_t v = 0; v < variants.size(); ++v) {
+                device.setKernel(kernelName, variants[v]);
+                size_t targetSize, maxSize, multiple;
+                device.getKernel()->getGroupSizes(device.getID(), device.getContext(), device.getMaxGroupSize(), device.getLocalMemSize(), targetSize, maxSize, multiple);
+                LaunchConfig config;
+                config.defines = variants[v];
+#ifdef TARGET_NATIVE
+                config.local = chooseLocalSize(global, targetSize, maxSize, multiple);
+                candidates.push_back(config);
+                for (size_t chunk = 1024; chunk <= std::max<size_t>(1024, global.getTotal() / 2); chunk *= 4) {
+                    config.chunkSize = chunk;
+                    candidates.push_back(config);
+                }
+#else
+                size_t previous = 0;
+                for (size_t target = std::max<size_t>(multiple, 1); target <= maxSize; target *= 2) {
+                    config.local = chooseLocalSize(global, target, maxSize, multiple);
+                    if (config.local.getTotal() != previous)
+                        candidates.push_back(config);
+                    previous = config.local.getTotal();
+                }
+#endif
+            }
+            return candidates;
+        }
+
+        /*! \brief The config for a launch of kernelName over global: the one in the database, or the fastest of candidates, that is then stored
+         \param bind Functor, that adds the arguments of the kernel: bind(device) is called after setKernel and clearParams. It is called for each candidate, so it should bind buffers, that already exist (addParam(Buffer&))
+         */
+        template <typename BIND>
+        LaunchConfig tune(Device& device, const std::string& kernelName, const NDRange& global, const std::vector<LaunchConfig>& candidates, BIND& bind) {
+            const std::string key = TuningDatabase::makeKey(device.name, kernelName, global);
+            LaunchConfig best;
+            if (database.find(key, best) || candidates.empty())
+                return best;
+            double bestTime = 0;
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                prepare(device, kernelName, candidates[i], bind);
+                Run run(device, global, candidates[i]);
+                const double time = timer->measure(candidates[i], run);
+                ++measured;
+                if (!i || time < bestTime) {
+                    best = candidates[i];
+                    bestTime = time;
+                }
+            }
+            printLog(LogTypeInfo, "tuned %s on %s: %s, %.3f ms\n", kernelName.c_str(), device.name.c_str(), best.toString().c_str(), bestTime);
+            database.store(key, best);
+            return best;
+        }
+
+        /// Same as tune, with the candidates of makeCandidates for variants
+        template <typename BIND>
+        LaunchConfig tune(Device& device, const std::string& kernelName, const NDRange& global, BIND& bind, const std::vector<KernelDefines>& variants = std::vector<KernelDefines>(1)) {
+            const std::string key = TuningDatabase::makeKey(device.name, kernelName, global);
+            LaunchConfig found;
+            if (database.find(key, found))
+                return found;
+            return tune(device, kernelName, global, makeCandidates(device, kernelName, global, variants), bind);
+        }
+
+        /// Sets the kernel variant of config as the current kernel of device, binds its arguments and applies the chunk size. Launch it with device.launchKernel(global, config.local)
+        template <typename BIND>
+        static void prepare(Device& device, const std::string& kernelName, const LaunchConfig& config, BIND& bind) {
+            device.setKernel(kernelName, config.defines);
+            device.clearParams();
+            bind(device);
+            device.setChunkSize(config.chunkSize);
+        }
+
+        /// \return Number of candidate launches measured so far
+        int getNumMeasured() const {
+            return measured;
+        }
+    private:
+        struct Run : TuningRun {
+            Run(Device& tunedDevice, const NDRange& globalSize, const LaunchConfig& launchConfig):device(tunedDevice), global(globalSize), config(launchConfig) {
+            }
+
+            void run() {
+                device.launchKernel(global, config.local).wait();
+            }
+
+            Device& device;
+            const NDRange& global;
+            const LaunchConfig& config;
+        };
+
+        TuningDatabase& database;
+        TuningTimer defaultTimer;
+        TuningTimer* timer;
+        int measured;
+    };
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "common.h"
+#include "event.h"
+#include "memory_pool.h"
 
 #if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
 #   error For GPAPI you need only to include gpapi.h
@@ -12,13 +14,14 @@ namespace GPAPI {
 	struct Buffer {
 public:
 		/*! Creates empty device memory buffer (does not alloce/transfer anything) */
-		Buffer()
+		Buffer():pool(NULL), size(0), view(false), hostMem(NULL)
 		{
 #ifdef TARGET_OPENCL
 			clMem = NULL;
 #endif //TARGET_OPENCL
 #ifdef TARGET_CUDA
 			cudaMem = NULL;
+			cudaContext = NULL;
 #endif //TARGET_CUDA
 #ifdef TARGET_NATIVE
 			nativeMem = NULL;
@@ -30,16 +33,22 @@ public:
 		   \param context Should be from the result of Device::getContext() method
 		   \param hostSrc If != NULL, this method will allocate numBytes of device memory and will transfer numBytes hostSrc memory to the allocated device memory. If hostSrc is NULL, transfer is not made (only allocation)
 		   \param numBytes Number of bytes to allocate(and possibly transfer). Should be > 0
+		   \param memoryPool If not NULL, the memory is taken from it and given back to it in freeMem (e.g. Device::getMemoryPool())
 		 */
-		void init(GPU_QUEUE queue, GPU_CONTEXT context, const void *hostSrc, size_t numBytes) {
+		void init(GPU_QUEUE queue, GPU_CONTEXT context, const void *hostSrc, size_t numBytes, MemoryPool* memoryPool = NULL) {
 			if (numBytes == 0)
 				return;
 
 			freeMem();
+			pool = memoryPool;
+			size = numBytes;
 			GPU_RESULT err = GPU_SUCCESS;
 
 #ifdef TARGET_OPENCL
-			clMem = clCreateBuffer(context, CL_MEM_READ_WRITE, numBytes, NULL, &err);
+			if (pool)
+				clMem = pool->alloc(numBytes);
+			else
+				clMem = clCreateBuffer(context, CL_MEM_READ_WRITE, numBytes, NULL, &err);
 			CHECK_ERROR(err);
 			if (hostSrc) {
 				err = clEnqueueWriteBuffer(queue, clMem, GPU_TRUE, 0, numBytes, hostSrc, 0, NULL, NULL);
@@ -47,8 +56,12 @@ public:
 			}
 #endif //TARGET_OPENCL
 #ifdef TARGET_CUDA
+			cudaContext = context;
 			pushContext(context);
-			err = cuMemAlloc(&cudaMem, numBytes);
+			if (pool)
+				cudaMem = pool->alloc(numBytes);
+			else
+				err = cuMemAlloc(&cudaMem, numBytes);
 			CHECK_ERROR(err);
 			if (hostSrc) {
 				err = cuMemcpyHtoD(cudaMem, hostSrc, numBytes);
@@ -57,7 +70,7 @@ public:
 			popContext(context);
 #endif //TARGET_CUDA
 #ifdef TARGET_NATIVE
-			nativeMem = new char[numBytes];
+			nativeMem = pool ? pool->alloc(numBytes) : new char[numBytes];
 			if (hostSrc) {
 				memcpy(nativeMem, hostSrc, numBytes);
 			}
@@ -66,6 +79,64 @@ public:
             
 		}
 
+		/*! \brief Makes a buffer, that uses hostPtr as its memory (zero-copy). Nothing is allocated or copied. Best on the native target and on CPU OpenCL devices (see Device::isHostMemoryShared)
+		   Kernels read and write hostPtr directly (an OpenCL GPU driver may still keep a copy on the device). A download to hostPtr only makes sure it has the last data, without copying.
+		   \param hostPtr Should stay valid until freeMem. On CUDA it is page-locked and mapped for the device (cuMemHostRegister) until then
+		 */
+		void initZeroCopy(GPU_QUEUE queue, GPU_CONTEXT context, void *hostPtr, size_t numBytes) {
+			if (numBytes == 0)
+				return;
+
+			freeMem();
+			size = numBytes;
+			hostMem = hostPtr;
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			clMem = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, numBytes, hostPtr, &err);
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			cudaContext = context;
+			pushContext(context);
+			err = cuMemHostRegister(hostPtr, numBytes, CU_MEMHOSTREGISTER_DEVICEMAP);
+			if (err == GPU_SUCCESS)
+				err = cuMemHostGetDevicePointer(&cudaMem, hostPtr, 0);
+			popContext(context);
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			nativeMem = hostPtr;
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+		}
+
+		/*! \brief Makes this buffer a view of bytes of parent, starting at offset. Nothing is allocated or transfered, the view uses the memory of parent and should be freed before it
+		   \param offset Should be a multiple of the device base address alignment (BufferArena::getAlignment)
+		 */
+		void initView(Buffer& parent, size_t offset, size_t bytes) {
+			freeMem();
+			size = bytes;
+			view = true;
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			cl_buffer_region region;
+			region.origin = offset;
+			region.size = bytes;
+			clMem = clCreateSubBuffer(parent.clMem, CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			cudaMem = parent.cudaMem + offset;
+			cudaContext = parent.cudaContext;
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			nativeMem = (char *)parent.nativeMem + offset;
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+		}
+
+		/*! \return Number of bytes, that init or initView was called with, 0 for an empty buffer */
+		size_t getSize() const {
+			return size;
+		}
+
 		/*! \return Returns pointer to the allocated *DEVICE* memory. Note that this pointer may not be valid host pointer (it might be valid only if TARGET_NATIVE is defined). If you need to read the device memory, use have to use Buffer::download method. */
 		void *get() {
 #ifdef TARGET_OPENCL
@@ -83,52 +154,339 @@ public:
 		void freeMem() {
 			GPU_RESULT err = GPU_SUCCESS;
 #ifdef TARGET_OPENCL
-			if (clMem)
+			//views are sub-buffers, that are released like any other cl_mem
+			if (clMem && pool)
+				pool->free(clMem, size);
+			else if (clMem)
 				err = clReleaseMemObject(clMem);
 			clMem = NULL;
 #endif //TARGET_OPENCL
 #ifdef TARGET_CUDA
-			if (cudaMem)
-				err = cuMemFree(cudaMem);
+			if (cudaMem && pool) {
+				pool->free(cudaMem, size);
+			} else if (hostMem || (cudaMem && !view)) {
+				//no context may be current on the calling thread, the memory belongs to the one it was allocated in
+				pushContext(cudaContext);
+				err = hostMem ? cuMemHostUnregister(hostMem) : cuMemFree(cudaMem);
+				popContext(cudaContext);
+			}
 			CHECK_ERROR(err);
 			cudaMem = NULL;
+			cudaContext = NULL;
 #endif //TARGET_CUDA
 #ifdef TARGET_NATIVE
-			delete[] (char *)nativeMem;
+			if (nativeMem && pool)
+				pool->free(nativeMem, size);
+			else if (!view && !hostMem)
+				delete[] (char *)nativeMem;
 			nativeMem = NULL;
 #endif //TARGET_NATIVE
+			pool = NULL;
+			size = 0;
+			view = false;
+			hostMem = NULL;
 			CHECK_ERROR(err);
 		}
 
 		/*! \brief Transfers allocated device memory to the host
 		   \param queue Should be from the result of Device::getQueue() method
 		   \param context Should be from the result of Device::getContext() method
-		   \param hostPtr Pointer to host memory (should points to at least 'bytes' bytes)
+		   \param hostPtr Pointer to host memory (should points to at least 'bytes' bytes). Transfers to HostBuffer memory are the fastest
 		   \param bytes Number of bytes that should be transfered from the device to the host. Shoud be > 0.
+		   \param offset Position in the buffer, that the transfer starts from
+		 */
+		void download(GPU_QUEUE queue, Context context, void *hostPtr, size_t bytes, size_t offset = 0) {
+			if (bytes == 0)
+				return;
+			checkRange(offset, bytes);
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			if (isWrapped(hostPtr, offset)) {
+				//zero-copy, mapping the buffer brings hostPtr up to date
+				void *mapped = clEnqueueMapBuffer(queue, clMem, GPU_TRUE, CL_MAP_READ, offset, bytes, 0, NULL, NULL, &err);
+				if (err == GPU_SUCCESS)
+					err = clEnqueueUnmapMemObject(queue, clMem, mapped, 0, NULL, NULL);
+			} else {
+				err = clEnqueueReadBuffer(queue, clMem, GPU_TRUE, offset, bytes, hostPtr, 0, NULL, NULL);
+			}
+#endif
+#ifdef TARGET_CUDA
+			pushContext(context);
+			//zero-copy, the kernels already wrote to hostPtr, it is enough to wait for them
+			if (isWrapped(hostPtr, offset))
+				err = queue ? cuStreamSynchronize(queue) : cuCtxSynchronize();
+			else
+				err = cuMemcpyDtoH(hostPtr, cudaMem + offset, bytes);
+			popContext(context);
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			//like a blocking read on an in-order queue, the work that is already on the queue is done first
+			if (queue)
+				queue->wait();
+			if (hostPtr != (char *)nativeMem + offset)
+				memcpy(hostPtr, (char *)nativeMem + offset, bytes);
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+		}
+
+		/*! \brief Transfers bytes from hostSrc to the device memory, starting at offset. Returns after the transfer is done, so only the changed part of a buffer has to be sent
+		   \param queue Should be from the result of Device::getQueue() method
+		   \param context Should be from the result of Device::getContext() method
+		   \param offset Position in the buffer, that the transfer starts from. offset + bytes should not be bigger than the allocated size
 		 */
-		void download(GPU_QUEUE queue, Context context, void *hostPtr, size_t bytes) {
+		void upload(GPU_QUEUE queue, Context context, const void *hostSrc, size_t bytes, size_t offset = 0) {
 			if (bytes == 0)
 				return;
+			checkRange(offset, bytes);
 			GPU_RESULT err = GPU_SUCCESS;
 #ifdef TARGET_OPENCL
-			err = clEnqueueReadBuffer(queue, *(cl_mem *)get(), GPU_TRUE, 0, bytes, hostPtr, 0, NULL, NULL);
+			err = clEnqueueWriteBuffer(queue, clMem, GPU_TRUE, offset, bytes, hostSrc, 0, NULL, NULL);
 #endif
 #ifdef TARGET_CUDA
 			pushContext(context);
-			err = cuMemcpyDtoH(hostPtr, cudaMem, bytes);
+			if (!isWrapped(hostSrc, offset))
+				err = cuMemcpyHtoD(cudaMem + offset, hostSrc, bytes);
+			popContext(context);
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			//the kernels, that are already on the queue, should see the old data
+			if (queue)
+				queue->wait();
+			if (hostSrc != (char *)nativeMem + offset)
+				memcpy((char *)nativeMem + offset, hostSrc, bytes);
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+		}
+
+		/*! \brief Starts copying bytes from this buffer to dst on the device, without going through the host
+		   \param queue Should be from the result of Device::getQueue() method
+		   \param context Should be from the result of Device::getContext() method
+		   \param dst Buffer of the same device. If it is this buffer, the two ranges should not overlap
+		   \param waitFor Events, that have to be done before the copy starts
+		   \return Event, that is done when the copy is done
+		 */
+		Event copyTo(GPU_QUEUE queue, GPU_CONTEXT context, Buffer &dst, size_t srcOffset, size_t dstOffset, size_t bytes, const Events& waitFor = Events()) {
+			Event event;
+			if (bytes == 0)
+				return event;
+			checkRange(srcOffset, bytes);
+			dst.checkRange(dstOffset, bytes);
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			std::vector<cl_event> waitList = getWaitList(waitFor);
+			cl_event clEvent;
+			err = clEnqueueCopyBuffer(queue, clMem, dst.clMem, srcOffset, dstOffset, bytes, (cl_uint)waitList.size(), waitList.empty() ? NULL : &waitList[0], &clEvent);
+			if (err == GPU_SUCCESS)
+				event = Event(clEvent);
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			pushContext(context);
+			err = streamWaitEvents(queue, waitFor);
+			if (err == GPU_SUCCESS)
+				err = cuMemcpyDtoDAsync(dst.cudaMem + dstOffset, cudaMem + srcOffset, bytes, queue);
+			popContext(context);
+			if (err == GPU_SUCCESS)
+				event = Event::record(queue, context);
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			event = Event(getNativeDevice()->copyAsync((char *)dst.nativeMem + dstOffset, (char *)nativeMem + srcOffset, bytes, getWaitList(waitFor), queue));
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+			return event;
+		}
+
+		/*! \brief Starts filling bytes of the buffer, starting at offset, with copies of pattern
+		   \param queue Should be from the result of Device::getQueue() method
+		   \param context Should be from the result of Device::getContext() method
+		   \param pattern Copied before the call returns
+		   \param patternSize 1, 2 or 4 bytes on all targets. OpenCL and native also take up to 128 bytes. offset and bytes should be multiples of it
+		   \param waitFor Events, that have to be done before the fill starts
+		   \return Event, that is done when the fill is done
+		 */
+		Event fill(GPU_QUEUE queue, GPU_CONTEXT context, const void *pattern, size_t patternSize, size_t offset, size_t bytes, const Events& waitFor = Events()) {
+			Event event;
+			if (bytes == 0)
+				return event;
+			checkRange(offset, bytes);
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			std::vector<cl_event> waitList = getWaitList(waitFor);
+			cl_event clEvent;
+			err = clEnqueueFillBuffer(queue, clMem, pattern, patternSize, offset, bytes, (cl_uint)waitList.size(), waitList.empty() ? NULL : &waitList[0], &clEvent);
+			if (err == GPU_SUCCESS)
+				event = Event(clEvent);
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			pushContext(context);
+			err = streamWaitEvents(queue, waitFor);
+			if (err == GPU_SUCCESS) {
+				switch (patternSize) {
+				case 1:
+					err = cuMemsetD8Async(cudaMem + offset, *(const unsigned char *)pattern, bytes, queue);
+					break;
+				case 2:
+					err = cuMemsetD16Async(cudaMem + offset, *(const unsigned short *)pattern, bytes / 2, queue);
+					break;
+				case 4:
+					err = cuMemsetD32Async(cudaMem + offset, *(const unsigned int *)pattern, bytes / 4, queue);
+					break;
+				default:
+					printLog(LogTypeError, "CUDA fill pattern should be 1, 2 or 4 bytes\n");
+					err = CUDA_ERROR_INVALID_VALUE;
+				}
+			}
+			popContext(context);
+			if (err == GPU_SUCCESS)
+				event = Event::record(queue, context);
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			event = Event(getNativeDevice()->fillAsync((char *)nativeMem + offset, pattern, patternSize, bytes, getWaitList(waitFor), queue));
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+			return event;
+		}
+
+		/*! \brief Starts transfering bytes from hostSrc to the device memory and returns without waiting for the transfer to finish
+		   \param queue Should be from the result of Device::getQueue() method
+		   \param context Should be from the result of Device::getContext() method
+		   \param hostSrc Should stay valid and unchanged until the returned event is done. Use HostBuffer memory, so the transfer does not go through a driver staging copy
+		   \param bytes Number of bytes to transfer
+		   \param waitFor Events, that have to be done before the transfer starts
+		   \param offset Position in the buffer, that the transfer starts from. offset + bytes should not be bigger than the allocated size
+		   \return Event, that is done when the transfer is done. The buffer should not be used by a kernel before that (pass it to Device::launchKernel)
+		 */
+		Event uploadAsync(GPU_QUEUE queue, GPU_CONTEXT context, const void *hostSrc, size_t bytes, const Events& waitFor = Events(), size_t offset = 0) {
+			Event event;
+			if (bytes == 0)
+				return event;
+			checkRange(offset, bytes);
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			std::vector<cl_event> waitList = getWaitList(waitFor);
+			cl_event clEvent;
+			err = clEnqueueWriteBuffer(queue, clMem, GPU_FALSE, offset, bytes, hostSrc, (cl_uint)waitList.size(), waitList.empty() ? NULL : &waitList[0], &clEvent);
+			if (err == GPU_SUCCESS)
+				event = Event(clEvent);
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			pushContext(context);
+			err = streamWaitEvents(queue, waitFor);
+			if (err == GPU_SUCCESS)
+				err = cuMemcpyHtoDAsync(cudaMem + offset, hostSrc, bytes, queue);
+			popContext(context);
+			if (err == GPU_SUCCESS)
+				event = Event::record(queue, context);
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			//nothing to copy for zero-copy buffers, but the event still keeps the order of the queue
+			event = Event(getNativeDevice()->copyAsync((char *)nativeMem + offset, hostSrc, hostSrc == (char *)nativeMem + offset ? 0 : bytes, getWaitList(waitFor), queue));
+#endif //TARGET_NATIVE
+			CHECK_ERROR(err);
+			return event;
+		}
+
+		/*! \brief Starts transfering bytes from the device memory to hostPtr and returns without waiting for the transfer to finish
+		   \param queue Should be from the result of Device::getQueue() method
+		   \param context Should be from the result of Device::getContext() method
+		   \param hostPtr Should stay valid until the returned event is done. Its content is not defined before that. Use HostBuffer memory, so the transfer does not go through a driver staging copy
+		   \param bytes Number of bytes to transfer
+		   \param waitFor Events, that have to be done before the transfer starts (e.g. the launch of the kernel, that writes the buffer)
+		   \param offset Position in the buffer, that the transfer starts from. offset + bytes should not be bigger than the allocated size
+		   \return Event, that is done when the transfer is done
+		 */
+		Event downloadAsync(GPU_QUEUE queue, GPU_CONTEXT context, void *hostPtr, size_t bytes, const Events& waitFor = Events(), size_t offset = 0) {
+			Event event;
+			if (bytes == 0)
+				return event;
+			checkRange(offset, bytes);
+			GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+			std::vector<cl_event> waitList = getWaitList(waitFor);
+			cl_event clEvent;
+			err = clEnqueueReadBuffer(queue, clMem, GPU_FALSE, offset, bytes, hostPtr, (cl_uint)waitList.size(), waitList.empty() ? NULL : &waitList[0], &clEvent);
+			if (err == GPU_SUCCESS)
+				event = Event(clEvent);
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			pushContext(context);
+			err = streamWaitEvents(queue, waitFor);
+			if (err == GPU_SUCCESS)
+				err = cuMemcpyDtoHAsync(hostPtr, cudaMem + offset, bytes, queue);
 			popContext(context);
+			if (err == GPU_SUCCESS)
+				event = Event::record(queue, context);
 #endif //TARGET_CUDA
 #ifdef TARGET_NATIVE
-			memcpy(hostPtr, nativeMem, bytes);
+			event = Event(getNativeDevice()->copyAsync(hostPtr, (char *)nativeMem + offset, hostPtr == (char *)nativeMem + offset ? 0 : bytes, getWaitList(waitFor), queue));
 #endif //TARGET_NATIVE
 			CHECK_ERROR(err);
+			return event;
 		}
 
 		~Buffer()
 		{
 			freeMem();
 		}
+
+#ifdef CPP11
+		/*! Takes the memory of other, which becomes empty. Buffers are move-only, so each memory has exactly one owner, that frees it */
+		Buffer(Buffer&& other):pool(NULL), size(0), view(false), hostMem(NULL)
+		{
+			take(other);
+		}
+
+		Buffer& operator=(Buffer&& other)
+		{
+			if (this != &other) {
+				freeMem();
+				take(other);
+			}
+			return *this;
+		}
+#endif //CPP11
 private:
+		Buffer(const Buffer&);
+		Buffer& operator=(const Buffer&);
+
+		/// Moves the memory of other to this buffer, that should be empty, and leaves other empty
+		void take(Buffer& other) {
+#ifdef TARGET_OPENCL
+			clMem = other.clMem;
+			other.clMem = NULL;
+#endif //TARGET_OPENCL
+#ifdef TARGET_CUDA
+			cudaMem = other.cudaMem;
+			cudaContext = other.cudaContext;
+			other.cudaMem = NULL;
+			other.cudaContext = NULL;
+#endif //TARGET_CUDA
+#ifdef TARGET_NATIVE
+			nativeMem = other.nativeMem;
+			other.nativeMem = NULL;
+#endif //TARGET_NATIVE
+			pool = other.pool;
+			size = other.size;
+			view = other.view;
+			hostMem = other.hostMem;
+			other.pool = NULL;
+			other.size = 0;
+			other.view = false;
+			other.hostMem = NULL;
+		}
+
+		/// Exits with an error if [offset, offset + bytes) is not inside the buffer
+		void checkRange(size_t offset, size_t bytes) const {
+			int err = (offset + bytes <= size) ? 0 : -1;
+			if (err)
+				printLog(LogTypeError, "range %i-%i is outside of the %i bytes of the buffer\n", (int)offset, (int)(offset + bytes), (int)size);
+			CHECK_ERROR(err);
+		}
+
+		/// \return true if hostPtr is the caller memory at offset, that a zero-copy buffer wraps
+		bool isWrapped(const void *hostPtr, size_t offset) const {
+			return hostMem && hostPtr == (const char *)hostMem + offset;
+		}
+
 #ifdef TARGET_OPENCL
 		///pointer to OpenCL device memory
 		cl_mem clMem;
@@ -136,10 +494,20 @@ private:
 #ifdef TARGET_CUDA
 		///pointer to CUDA device memory
 		CUdeviceptr cudaMem;
+		///the context, that the memory was allocated in
+		GPU_CONTEXT cudaContext;
 #endif //TARGET_CUDA
 #ifdef TARGET_NATIVE
 		///pointer to NATIVE device memory
 		void *nativeMem;
 #endif //TARGET_NATIVE
+		///the pool, that the memory came from. NULL if it was allocated directly
+		MemoryPool *pool;
+		///number of bytes, that init or initView was called with
+		size_t size;
+		///true if the memory belongs to another buffer (see initView)
+		bool view;
+		///the caller memory, that the buffer wraps (see initZeroCopy). NULL if the buffer has its own memory
+		void *hostMem;
 	};
 }
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "common.h"
+#include "buffer.h"
+
+#if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /*! \brief Many small buffers in one device allocation.
+     add reserves an aligned part of the arena for each buffer. upload then makes one allocation, sends the data of all the parts in one packed transfer and turns each part into a view (Buffer::initView).
+     The views can be used as kernel arguments like any other buffer (KernelLaunch::addArg, Device::addParam(Buffer*)).
+     */
+    struct BufferArena {
+        BufferArena():alignment(1), totalBytes(0) {
+        }
+
+        /// \param device, context Should be from the results of Device::getID() and Device::getContext() methods
+        void init(GPU_DEVICE device, GPU_CONTEXT contextId) {
+            freeMem();
+            context = contextId;
+            alignment = getAlignment(device);
+        }
+
+        /*! \brief Reserves bytes in the arena. No memory is allocated or transfered before upload
+         \param hostSrc If not NULL, bytes from it are sent to the buffer by upload. Should stay valid until then
+         \return The buffer, that becomes valid after upload. The arena owns it
+         */
+        Buffer* add(const void* hostSrc, size_t bytes) {
+            Part part;
+            part.hostSrc = hostSrc;
+            part.offset = (totalBytes + alignment - 1) / alignment * alignment;
+            part.bytes = bytes;
+            part.buffer = new Buffer;
+            parts.push_back(part);
+            totalBytes = part.offset + bytes;
+            return part.buffer;
+        }
+
+        /*! \brief Allocates the arena, transfers the data of all the parts at once and makes the buffers, that add returned, valid
+         \param queue Should be from the result of Device::getQueue() method
+         \param memoryPool If not NULL, the arena memory is taken from it (e.g. Device::getMemoryPool())
+         */
+        void upload(GPU_QUEUE queue, MemoryPool* memoryPool = NULL) {
+            if (!totalBytes)
+                return;
+            std::vector<char> packed;
+            for (size_t i = 0; i < parts.size(); ++i) {
+                if (!parts[i].hostSrc)
+                    continue;
+                if (packed.empty())
+                    packed.resize(totalBytes);
+                memcpy(&packed[parts[i].offset], parts[i].hostSrc, parts[i].bytes);
+            }
+            memory.init(queue, context, packed.empty() ? NULL : &packed[0], totalBytes, memoryPool);
+            for (size_t i = 0; i < parts.size(); ++i)
+                parts[i].buffer->initView(memory, parts[i].offset, parts[i].bytes);
+        }
+
+        /// \return The buffer with the memory of all the parts
+        Buffer& getBuffer() {
+            return memory;
+        }
+
+        /// \return Number of bytes of the arena, alignment gaps included
+        size_t getSize() const {
+            return totalBytes;
+        }
+
+        /// Frees the arena and all the buffers, that add returned
+        void freeMem() {
+            for (size_t i = 0; i < parts.size(); ++i) {
+                parts[i].buffer->freeMem();
+                delete parts[i].buffer;
+            }
+            parts.clear();
+            memory.freeMem();
+            totalBytes = 0;
+        }
+
+        ~BufferArena() {
+            freeMem();
+        }
+
+        /// \return The alignment of the start of a view, in bytes
+        static size_t getAlignment(GPU_DEVICE device) {
+            size_t result = 1;
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            cl_uint bits = 0;
+            err = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(bits), &bits, NULL);
+            result = std::max<size_t>(bits / 8, 1);
+#endif
+#ifdef TARGET_CUDA
+            //cuMemAlloc memory is aligned to at least 256 bytes, so the views keep the same alignment
+            result = 256;
+#endif
+#ifdef TARGET_NATIVE
+            //cache line, so views do not share lines
+            result = 64;
+#endif
+            CHECK_ERROR(err);
+            return result;
+        }
+    private:
+        struct Part {
+            const void* hostSrc;
+            size_t offset;
+            size_t bytes;
+            Buffer* buffer;
+        };
+
+        GPU_CONTEXT context;
+        size_t alignment;
+        size_t totalBytes;
+        std::vector<Part> parts;
+        Buffer memory;
+
+        BufferArena(const BufferArena&);
+        BufferArena& operator=(const BufferArena&);
+    };
+}
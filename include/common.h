@@ -56,7 +56,7 @@
 #define GPU_PROGRAM CUmodule
 #define GPU_KERNEL CUfunction
 #define GPU_STREAM CUstream
-#define GPU_QUEUE void*
+#define GPU_QUEUE CUstream
 #endif
 
 #ifdef TARGET_NATIVE
@@ -65,13 +65,18 @@
 #   endif
 #
 #define GPU_CONTEXT int
-#define GPU_QUEUE int
+#define GPU_QUEUE GPAPI::NativeQueue*
 #define GPU_RESULT int
 #define GPU_SUCCESS 0
 #define GPU_DEVICE int
-#define GPU_KERNEL int
+#define GPU_KERNEL const GPAPI::NativeKernelInfo*
 #define GPU_PROGRAM int
 #define GPU_PLATFORM int
+
+namespace GPAPI {
+    struct NativeKernelInfo;
+    struct NativeQueue;
+}
 #endif
 
 #define Platform GPU_PLATFORM
@@ -79,11 +84,45 @@
 #define Context GPU_CONTEXT
 #define Program GPU_PROGRAM
 
+#include <algorithm>
 #include <memory>
 #include <fstream>
 #include <vector>
+#include <deque>
+#include <map>
+#include <string>
 #include <cmath>
 #include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+
+#ifdef CPP11
+#   include <atomic>
+#   include <chrono>
+#   include <mutex>
+#   include <thread>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <windows.h>
+#   include <direct.h>
+#   include <process.h>
+#   include <sys/utime.h>
+#else
+#   include <dirent.h>
+#   include <unistd.h>
+#   include <utime.h>
+#endif
 
 
 namespace GPAPI {
@@ -99,8 +138,14 @@ void printLog(LogType priority, const char *format, ...) {
     char s[512];
     
     time_t t = time(NULL);
-    struct tm * p = localtime(&t);
-    strftime(s, 512, "[%H:%M:%S] ", p);
+    struct tm local;
+    //not localtime, which shares one result between threads
+#ifdef _WIN32
+    localtime_s(&local, &t);
+#else
+    localtime_r(&t, &local);
+#endif
+    strftime(s, 512, "[%H:%M:%S] ", &local);
     
     printf("%s", s);
     switch (priority) {
@@ -125,6 +170,68 @@ void printLog(LogType priority, const char *format, ...) {
     va_end(args);
 }
 
+/// Creates the directory at path, if it is missing
+inline
+void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+/// Sets the modification time of the file at path to now
+inline
+void touchFile(const std::string& path) {
+#ifdef _WIN32
+    _utime(path.c_str(), NULL);
+#else
+    utime(path.c_str(), NULL);
+#endif
+}
+
+/// \return Names of the files in the directory at path, empty if it can not be read
+inline
+std::vector<std::string> listDirectory(const std::string& path) {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((path + "/*").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE)
+        return names;
+    do {
+        names.push_back(entry.cFileName);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* directory = opendir(path.c_str());
+    if (!directory)
+        return names;
+    while (dirent* entry = readdir(directory))
+        names.push_back(entry->d_name);
+    closedir(directory);
+#endif
+    return names;
+}
+
+/// \return Suffix of a temporary file name, that no other call of this or of another process returns. Files are written to such a name and renamed, so readers never see them half-written
+inline
+std::string getTempSuffix() {
+#ifdef CPP11
+    static std::atomic<unsigned> counter(0);
+#else
+    static unsigned counter = 0;
+#endif
+#ifdef _WIN32
+    const int processID = _getpid();
+#else
+    const int processID = (int)getpid();
+#endif
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%i.%u.tmp", processID, (unsigned)counter++);
+    return suffix;
+}
+
 template<typename T>
 inline
 void __checkError(T error, const char* file, int line) {
@@ -136,6 +243,62 @@ void __checkError(T error, const char* file, int line) {
 
 #define CHECK_ERROR(X) __checkError(X, __FILE__, __LINE__)
 
+/*! \brief Calls task(i) for each i in [0, count) on a pool of threads, one per core at most. Returns when all the calls are done.
+ Without C++11 the calls are made one after another on the calling thread
+ */
+template <typename TASK>
+inline
+void parallelFor(int count, TASK& task) {
+#ifdef CPP11
+    const int numThreads = std::min<int>(count, std::max(1u, std::thread::hardware_concurrency()));
+    if (numThreads > 1) {
+        std::atomic<int> next(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; ++t)
+            threads.push_back(std::thread([&]() {
+                for (int i = next++; i < count; i = next++)
+                    task(i);
+            }));
+        for (int t = 0; t < numThreads; ++t)
+            threads[t].join();
+        return;
+    }
+#endif
+    for (int i = 0; i < count; ++i)
+        task(i);
+}
+
+/// Logs how long each phase of the device initialization takes, so startup regressions are visible
+struct InitTimer {
+    InitTimer() {
+        start = last = now();
+    }
+    
+    /// Logs the time since the previous phase (or the timer creation) as the time of phase
+    void phase(const char* name) {
+        const double time = now();
+        printLog(LogTypeInfo, "init phase '%s' took %.1f ms\n", name, time - last);
+        last = time;
+    }
+    
+    /// Logs the time since the timer creation
+    void total(const char* name) {
+        printLog(LogTypeInfo, "'%s' took %.1f ms\n", name, now() - start);
+    }
+    
+    /// \return Wall time in milliseconds (CPU time without C++11)
+    static double now() {
+#ifdef CPP11
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+        return clock() * 1000.0 / CLOCKS_PER_SEC;
+#endif
+    }
+private:
+    double start;
+    double last;
+};
+
 inline
 void pushContext(GPU_CONTEXT context) {
 #ifdef TARGET_CUDA
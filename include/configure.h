@@ -10,6 +10,14 @@
 #define LOG_LEVEL LogTypeInfo
 
 //! \brief Sets the target, for which the project should be build. TARGET_CUDA, TARGET_OPENCL and TARGET_NATIVE are available
+//! A target given on the compiler command line (e.g. -DTARGET_NATIVE, as the CMake build of the tests does) is used instead
+#if !(defined TARGET_CUDA) && !(defined TARGET_OPENCL) && !(defined TARGET_NATIVE)
 #define TARGET_CUDA
 //#define TARGET_OPENCL
 //#define TARGET_NATIVE
+#endif
+
+//! \brief Defined when the compiler has C++11 (MSVC reports its standard in _MSVC_LANG). Set here, so that every translation unit sees the same Buffer, Device and Event layouts
+#if __cplusplus >= 201103L || (defined _MSVC_LANG && _MSVC_LANG >= 201103L)
+#   define CPP11
+#endif
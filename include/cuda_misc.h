@@ -11,6 +11,217 @@
 #include "init_params.h"
 
 namespace GPAPI {
+    /// Compiles CUDA source to PTX with NVRTC. The build functor of ProgramCache::get
+    struct NVRTCCompiler {
+        NVRTCCompiler(const std::string& programSource, const char** compileOptions, int numCompileOptions)
+            :source(programSource), options(compileOptions), numOptions(numCompileOptions) {
+        }
+        
+        void operator()(std::vector<char>& ptx) {
+            nvrtcProgram program;
+            nvrtcResult nvRes = nvrtcCreateProgram(&program, source.c_str(), "compiled_kernel", 0, NULL, NULL);
+            CHECK_ERROR(nvRes);
+            nvRes = nvrtcCompileProgram(program, numOptions, options);
+            
+            if (nvRes != NVRTC_SUCCESS) {
+                size_t programLogSize;
+                nvRes = nvrtcGetProgramLogSize(program, &programLogSize);
+                CHECK_ERROR(nvRes);
+                char* log = new char[programLogSize + 1];
+                
+                nvRes = nvrtcGetProgramLog(program, log);
+                CHECK_ERROR(nvRes);
+                printLog(LogTypeError, "%s", log);
+                
+                delete[] log;
+            }
+            
+            size_t ptxSize;
+            nvRes = nvrtcGetPTXSize(program, &ptxSize);
+            CHECK_ERROR(nvRes);
+            
+            ptx.resize(ptxSize + 1);
+            nvRes = nvrtcGetPTX(program, &ptx[0]);
+            CHECK_ERROR(nvRes);
+            nvRes = nvrtcDestroyProgram(&program);
+            CHECK_ERROR(nvRes);
+        }
+    private:
+        const std::string& source;
+        const char** options;
+        int numOptions;
+    };
+    
+    /// \return The cubin of ptx for the device of the current context, with the JIT options GPAPI programs use
+    inline std::vector<char> linkCUDAProgram(const std::vector<char>& ptx) {
+        const size_t JIT_NUM_OPTIONS = 8;
+        const size_t JIT_BUFFER_SIZE_IN_BYTES = 1024;
+        char logBuffer[JIT_BUFFER_SIZE_IN_BYTES];
+        char errorBuffer[JIT_BUFFER_SIZE_IN_BYTES];
+        
+        CUjit_option jitOptions[JIT_NUM_OPTIONS];
+        int optionsCounter = 0;
+        jitOptions[optionsCounter++] = CU_JIT_MAX_REGISTERS;
+        jitOptions[optionsCounter++] = CU_JIT_OPTIMIZATION_LEVEL;
+        jitOptions[optionsCounter++] = CU_JIT_TARGET_FROM_CUCONTEXT;
+        jitOptions[optionsCounter++] = CU_JIT_FALLBACK_STRATEGY;
+        jitOptions[optionsCounter++] = CU_JIT_INFO_LOG_BUFFER;
+        jitOptions[optionsCounter++] = CU_JIT_INFO_LOG_BUFFER_SIZE_BYTES;
+        jitOptions[optionsCounter++] = CU_JIT_ERROR_LOG_BUFFER;
+        jitOptions[optionsCounter++] = CU_JIT_ERROR_LOG_BUFFER_SIZE_BYTES;
+        void* jitValues[JIT_NUM_OPTIONS];
+        const int maxRegCount = 63;
+        int valuesCounter = 0;
+        jitValues[valuesCounter++] = (void*)maxRegCount;
+        const int optimizationLevel = 4;
+        jitValues[valuesCounter++] = (void*)optimizationLevel;
+        const int dummy = 0;
+        jitValues[valuesCounter++] = (void*)dummy;
+        const CUjit_fallback_enum fallbackStrategy = CU_PREFER_PTX;
+        jitValues[valuesCounter++] = (void*)fallbackStrategy;
+        jitValues[valuesCounter++] = (void*)logBuffer;
+        const int logBufferSize = JIT_BUFFER_SIZE_IN_BYTES;
+        jitValues[valuesCounter++] = (void*)logBufferSize;
+        jitValues[valuesCounter++] = (void*)errorBuffer;
+        const int errorBufferSize = JIT_BUFFER_SIZE_IN_BYTES;
+        jitValues[valuesCounter++] = (void*)errorBufferSize;
+        
+        logBuffer[0] = errorBuffer[0] = 0;
+        CUlinkState link;
+        GPU_RESULT err = cuLinkCreate(JIT_NUM_OPTIONS, jitOptions, jitValues, &link);
+        CHECK_ERROR(err);
+        void* cubin = NULL;
+        size_t cubinSize = 0;
+        err = cuLinkAddData(link, CU_JIT_INPUT_PTX, (void*)&ptx[0], ptx.size(), "compiled_kernel", 0, NULL, NULL);
+        if (err == GPU_SUCCESS)
+            err = cuLinkComplete(link, &cubin, &cubinSize);
+        if (err != GPU_SUCCESS)
+            printLog(LogTypeError, "%s", errorBuffer);
+        CHECK_ERROR(err);
+        //the cubin belongs to the link state, so it is copied before cuLinkDestroy
+        std::vector<char> result((char*)cubin, (char*)cubin + cubinSize);
+        err = cuLinkDestroy(link);
+        CHECK_ERROR(err);
+        return result;
+    }
+    
+    /// \return The NVRTC options, that GPAPI programs are compiled with
+    inline std::vector<std::string> getCUDACompileOptions() {
+        std::vector<std::string> options;
+        options.push_back("--gpu-architecture=compute_20");
+        options.push_back("--maxrregcount=64");
+        options.push_back("--use_fast_math");
+        return options;
+    }
+    
+    /// \return The version of NVRTC, the PTX depends on it
+    inline std::string getNVRTCVersion() {
+        int major = 0, minor = 0;
+        nvrtcResult nvRes = nvrtcVersion(&major, &minor);
+        CHECK_ERROR(nvRes);
+        char version[64];
+        snprintf(version, sizeof(version), "nvrtc %i.%i", major, minor);
+        return version;
+    }
+    
+    /// \return The PTX of source, compiled with options, from cache or compiled now (and cached)
+    inline std::vector<char> getCUDAPTX(const std::string& source, const std::vector<std::string>& options, ProgramCache& cache) {
+        std::vector<const char*> optionPtrs;
+        std::string optionsKey;
+        for (size_t i = 0; i < options.size(); ++i) {
+            optionPtrs.push_back(options[i].c_str());
+            optionsKey += options[i] + " ";
+        }
+        std::vector<char> ptx;
+        NVRTCCompiler compiler(source, optionPtrs.empty() ? NULL : &optionPtrs[0], (int)optionPtrs.size());
+        if (cache.get(ProgramCache::makeKey(source, optionsKey, "ptx", getNVRTCVersion()), ptx, compiler))
+            printLog(LogTypeInfo, "PTX loaded from the cache\n");
+        return ptx;
+    }
+    
+    /// \return The module of source for the device of context, compiled with the default options and extraOptions (e.g. the defines of a kernel variant)
+    inline CUmodule compileCUDAProgram(CUcontext context, const std::string& source, const std::vector<std::string>& extraOptions, ProgramCache& cache) {
+        std::vector<std::string> options = getCUDACompileOptions();
+        options.insert(options.end(), extraOptions.begin(), extraOptions.end());
+        const std::vector<char> ptx = getCUDAPTX(source, options, cache);
+        pushContext(context);
+        const std::vector<char> cubin = linkCUDAProgram(ptx);
+        CUmodule module;
+        GPU_RESULT err = cuModuleLoadData(&module, &cubin[0]);
+        CHECK_ERROR(err);
+        popContext(context);
+        return module;
+    }
+    
+    /// Creates the context of one device. The task of parallelFor in initCUDA
+    template <typename CONTEXTS, typename DEVICES>
+    struct CUDAContextTask {
+        CUDAContextTask(CONTEXTS& contextIds, const DEVICES& deviceIds):contexts(contextIds), devices(deviceIds) {
+        }
+        
+        void operator()(int i) {
+            GPU_RESULT err = cuCtxCreate(&contexts[i], CU_CTX_SCHED_AUTO, devices[i]);
+            CHECK_ERROR(err);
+            //cuCtxCreate makes the context current to this thread. GPAPI pushes it each time it is used instead
+            GPU_CONTEXT current;
+            err = cuCtxPopCurrent(&current);
+            CHECK_ERROR(err);
+        }
+        
+        CONTEXTS& contexts;
+        const DEVICES& devices;
+    };
+    
+    /// Loads the program of one group of identical devices, with one cubin for all of them. The task of parallelFor in initCUDA
+    template <typename PROGRAMS, typename CONTEXTS>
+    struct CUDAProgramTask {
+        CUDAProgramTask(PROGRAMS& programIds, const CONTEXTS& contextIds, const std::vector<std::vector<int> >& deviceGroups, const std::vector<std::string>& deviceModels,
+                        const std::vector<char>& programPTX, ProgramCache& programCache, const std::string& programSource, const std::string& compileOptions, const std::string& driverVersion)
+            :programs(programIds), contexts(contextIds), groups(deviceGroups), models(deviceModels), ptx(programPTX), cache(programCache), source(programSource), options(compileOptions), driver(driverVersion) {
+        }
+        
+        void operator()(int group) {
+            const std::vector<int>& indexes = groups[group];
+            const int first = indexes[0];
+            const std::string key = ProgramCache::makeKey(source, options, models[first], driver);
+            std::vector<char> cubin;
+            bool cached = cache.load(key, cubin);
+            for (size_t j = 0; j < indexes.size(); ++j) {
+                const int i = indexes[j];
+                pushContext(contexts[i]);
+                GPU_RESULT err = cubin.empty() ? CUDA_ERROR_INVALID_VALUE : cuModuleLoadData(&programs[i], &cubin[0]);
+                if (err == GPU_SUCCESS) {
+                    if (cached)
+                        printLog(LogTypeInfo, "program for device %i loaded from the cache\n", i);
+                    else
+                        printLog(LogTypeInfo, "program for device %i shared with identical device %i\n", i, first);
+                } else {
+                    if (cached) {
+                        printLog(LogTypeWarning, "cached program for device %i is rejected, compiling it again\n", i);
+                        cache.erase(key);
+                        cached = false;
+                    }
+                    cubin = linkCUDAProgram(ptx);
+                    err = cuModuleLoadData(&programs[i], &cubin[0]);
+                    CHECK_ERROR(err);
+                    cache.store(key, cubin);
+                    printLog(LogTypeInfo, "program for device %i compiled\n", i);
+                }
+                popContext(contexts[i]);
+            }
+        }
+        
+        PROGRAMS& programs;
+        const CONTEXTS& contexts;
+        const std::vector<std::vector<int> >& groups;
+        const std::vector<std::string>& models;
+        const std::vector<char>& ptx;
+        ProgramCache& cache;
+        const std::string& source;
+        const std::string& options;
+        const std::string& driver;
+    };
+    
     template <typename PLATFORMS, typename DEVICES, typename NAMES, typename CONTEXTS, typename PROGRAMS, typename LOCAL_MEM, typename THREADS_PER_BLOCK>
     void initCUDA(PLATFORMS& platformIds, DEVICES& deviceIds, NAMES& deviceNames, CONTEXTS& contextIds, PROGRAMS& programIds, const::std::string& source, LOCAL_MEM& localMemory, THREADS_PER_BLOCK& threadsPerBlock, InitParams initParams) {
         
@@ -23,6 +234,8 @@ namespace GPAPI {
         
         platformIds.push_back(0);
         
+        InitTimer timer;
+        std::vector<std::string> models;
         for (unsigned i = 0; i < count; ++i) {
             if (!initParams.isActive(InitParams::VendorParams::NVidia,
                                     InitParams::VendorParams::GPU,
@@ -54,83 +267,58 @@ namespace GPAPI {
             threadsPerBlock.push_back(threads);
             
             printLog(LogTypeInfo, "found device '%i' = %s, sharedMem=%i, threadsPerBlock=%i\n", i, buffer, sharedMemSize, threads);
-
             
-            GPU_CONTEXT pctx;
-            err = cuCtxCreate(&pctx, CU_CTX_SCHED_AUTO, device);
+            int major = 0, minor = 0;
+            err = cuDeviceGetAttribute(&major, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device);
+            if (err == GPU_SUCCESS)
+                err = cuDeviceGetAttribute(&minor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device);
             CHECK_ERROR(err);
-            
-            contextIds.push_back(pctx);
-            
+            char model[1024];
+            snprintf(model, sizeof(model), "%s sm_%i%i", (char*)buffer, major, minor);
+            models.push_back(model);
         }
-        nvrtcResult nvRes;
-        nvrtcProgram program;
-        nvRes = nvrtcCreateProgram(&program, source.c_str(), "compiled_kernel", 0, NULL, NULL);
-        CHECK_ERROR(nvRes);
-        const char* options[3] = {"--gpu-architecture=compute_20","--maxrregcount=64","--use_fast_math"};
-        nvRes = nvrtcCompileProgram(program, 3, options);
+        timer.phase("query devices");
         
-        if (nvRes != NVRTC_SUCCESS) {
-            size_t programLogSize;
-            nvRes = nvrtcGetProgramLogSize(program, &programLogSize);
-            CHECK_ERROR(nvRes);
-            char* log = new char[programLogSize + 1];
-            
-            nvRes = nvrtcGetProgramLog(program, log);
-            CHECK_ERROR(nvRes);
-            printLog(LogTypeError, "%s", log);
-            
-            delete[] log;
-        }
+        contextIds.resize(deviceIds.size());
+        CUDAContextTask<CONTEXTS, DEVICES> contextTask(contextIds, deviceIds);
+        parallelFor((int)deviceIds.size(), contextTask);
+        timer.phase("create contexts");
         
-        size_t ptxSize;
-        nvRes = nvrtcGetPTXSize(program, &ptxSize);
-        CHECK_ERROR(nvRes);
+        if (initParams.compileMode != InitParams::CompileAtInit) {
+            //each device compiles its program when it is first used
+            programIds.resize(deviceIds.size());
+            return;
+        }
+        ProgramCache cache(initParams.programCacheDir, initParams.programCacheMaxBytes);
+        const std::vector<std::string> options = getCUDACompileOptions();
+        std::string optionsKey;
+        for (size_t i = 0; i < options.size(); ++i)
+            optionsKey += options[i] + " ";
         
-        char* ptx = new char[ptxSize + 1];
-        nvRes = nvrtcGetPTX(program, ptx);
+        //the PTX depends only on the source, the options and the compiler, so it is shared by all devices
+        const std::vector<char> ptx = getCUDAPTX(source, options, cache);
+        timer.phase("compile PTX");
         
-        const size_t JIT_NUM_OPTIONS = 8;
-        const size_t JIT_BUFFER_SIZE_IN_BYTES = 1024;
-        char logBuffer[JIT_BUFFER_SIZE_IN_BYTES];
-        char errorBuffer[JIT_BUFFER_SIZE_IN_BYTES];
-        
-        CUjit_option jitOptions[JIT_NUM_OPTIONS];
-        int optionsCounter = 0;
-        jitOptions[optionsCounter++] = CU_JIT_MAX_REGISTERS;
-        jitOptions[optionsCounter++] = CU_JIT_OPTIMIZATION_LEVEL;
-        jitOptions[optionsCounter++] = CU_JIT_TARGET_FROM_CUCONTEXT;
-        jitOptions[optionsCounter++] = CU_JIT_FALLBACK_STRATEGY;
-        jitOptions[optionsCounter++] = CU_JIT_INFO_LOG_BUFFER;
-        jitOptions[optionsCounter++] = CU_JIT_INFO_LOG_BUFFER_SIZE_BYTES;
-        jitOptions[optionsCounter++] = CU_JIT_ERROR_LOG_BUFFER;
-        jitOptions[optionsCounter++] = CU_JIT_ERROR_LOG_BUFFER_SIZE_BYTES;
-        void* jitValues[JIT_NUM_OPTIONS];
-        const int maxRegCount = 63;
-        int valuesCounter = 0;
-        jitValues[valuesCounter++] = (void*)maxRegCount;
-        const int optimizationLevel = 4;
-        jitValues[valuesCounter++] = (void*)optimizationLevel;
-        const int dummy = 0;
-        jitValues[valuesCounter++] = (void*)dummy;
-        const CUjit_fallback_enum fallbackStrategy = CU_PREFER_PTX;
-        jitValues[valuesCounter++] = (void*)fallbackStrategy;
-        jitValues[valuesCounter++] = (void*)logBuffer;
-        const int logBufferSize = JIT_BUFFER_SIZE_IN_BYTES;
-        jitValues[valuesCounter++] = (void*)logBufferSize;
-        jitValues[valuesCounter++] = (void*)errorBuffer;
-        const int errorBufferSize = JIT_BUFFER_SIZE_IN_BYTES;
-        jitValues[valuesCounter++] = (void*)errorBufferSize;
+        int driverVersion = 0;
+        err = cuDriverGetVersion(&driverVersion);
+        CHECK_ERROR(err);
+        char driver[64];
+        snprintf(driver, sizeof(driver), "%s driver %i", getNVRTCVersion().c_str(), driverVersion);
+        //identical devices (same model, same compute capability) share one cubin
+        std::map<std::string, int> groupOfModel;
+        std::vector<std::vector<int> > groups;
         for (int i = 0; i < deviceIds.size(); ++i) {
-            GPU_PROGRAM program;
-            err = cuModuleLoadDataEx(&program, ptx, JIT_NUM_OPTIONS, jitOptions, jitValues);
-            CHECK_ERROR(err);
-            programIds.push_back(program);
-            printLog(LogTypeInfo, "program for device %i compiled\n", i);
+            std::map<std::string, int>::iterator it = groupOfModel.find(models[i]);
+            if (it == groupOfModel.end()) {
+                it = groupOfModel.insert(std::make_pair(models[i], (int)groups.size())).first;
+                groups.push_back(std::vector<int>());
+            }
+            groups[it->second].push_back(i);
         }
-        nvRes = nvrtcDestroyProgram(&program);
-        CHECK_ERROR(nvRes);
-        delete[] ptx;
+        programIds.resize(deviceIds.size());
+        CUDAProgramTask<PROGRAMS, CONTEXTS> programTask(programIds, contextIds, groups, models, ptx, cache, source, optionsKey, driver);
+        parallelFor((int)groups.size(), programTask);
+        timer.phase("load programs");
     }
 }
 
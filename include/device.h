@@ -15,8 +15,21 @@ namespace GPAPI {
         typedef  InitParams::VendorParams::VendorType VendorType;
         typedef InitParams::VendorParams::DeviceType DeviceType;
         
-        virtual void init(Platform platformId, DeviceID deviceId, std::string nameId, Context contextId, Program programId, VendorType vendorTypeId, DeviceType deviceTypeId, size_t localMemSizeId, size_t threadPerBlockId) {
+        Device():programReady(true), current(NULL) {
+        }
+        
+        /*! \param sourceCode The source of programId. Kernel variants (setKernel with defines) are compiled from it
+         \param cache Where the compiled variants are cached between runs
+         \param compileMode If not CompileAtInit, programId is not compiled yet (NULL): the first setKernel compiles it, or a background thread started here
+         */
+        virtual void init(Platform platformId, DeviceID deviceId, std::string nameId, Context contextId, Program programId, VendorType vendorTypeId, DeviceType deviceTypeId, size_t localMemSizeId, size_t threadPerBlockId,
+                          const std::string& sourceCode = std::string(), const ProgramCache& cache = ProgramCache(), InitParams::CompileMode compileMode = InitParams::CompileAtInit) {
+            joinPrewarm();
             freeMem();
+            freeVariants();
+            source = sourceCode;
+            programCache = cache;
+            programReady = compileMode == InitParams::CompileAtInit;
             maxLocalMemSize = localMemSizeId;
             maxThreadsPerBlock = threadPerBlockId;
             
@@ -25,59 +38,378 @@ namespace GPAPI {
             context = contextId;
             program = programId;
             name = nameId;
+            vendorType = vendorTypeId;
+            deviceType = deviceTypeId;
             
-            queue.init(device, context);
+            freeQueues();
+            setNumQueues(1);
+            memoryPool.init(context);
+#ifdef CPP11
+            if (compileMode == InitParams::CompileInBackground)
+                prewarmThread = std::thread([this]() { getCompiledProgram(); });
+#endif
         }
         
-        void launchKernel(size_t globalSize, size_t localSize) {
-            kernelLaunch.run(queue.get(), context, globalSize, localSize);
-        };
+        /*! \brief Starts the current kernel on the queue at queueIndex, after all the events in waitFor are done. Does not block
+         globalSize is rounded up to a multiple of the local size, so the kernel should check its id against the real size
+         \param localSize If 0, it is picked for the kernel (see getLocalSize)
+         \return Event, that is done when the kernel is done. Pass it to later launches or transfers, that use its results
+         */
+        Event launchKernel(size_t globalSize, size_t localSize, const Events& waitFor = Events(), int queueIndex = 0) {
+            return launchKernel(NDRange(globalSize), localSize ? NDRange(localSize) : NDRange(), waitFor, queueIndex);
+        }
+        
+        /*! \brief Same as launchKernel(size_t, size_t), for a launch with 1, 2 or 3 dimensions, e.g. NDRange(width, height) for an image.
+         Each global size is rounded up to a multiple of the local size, so the kernel should check globalIDDim(dim) against the real sizes
+         \param local The work-group size. If it is the empty NDRange(), it is picked for the kernel (see getLocalSize)
+         */
+        Event launchKernel(const NDRange& global, const NDRange& local = NDRange(), const Events& waitFor = Events(), int queueIndex = 0) {
+            const NDRange groupSize = local.isEmpty() ? getLocalSize(global) : local;
+            syncMirrors();
+            Event event = current->launch.run(getQueue(queueIndex), context, global, groupSize, waitFor);
+            addMirrorsUse(event);
+            return event;
+        }
+        
+        /*! \brief The work-group size for a launch of the current kernel over global, from the limits of the device and the resources, that the kernel uses (see Kernel::getGroupSizes and chooseLocalSize)
+         */
+        NDRange getLocalSize(const NDRange& global) {
+            size_t targetSize, maxSize, multiple;
+            current->kernel.getGroupSizes(device, context, getMaxGroupSize(), maxLocalMemSize, targetSize, maxSize, multiple);
+            return chooseLocalSize(global, targetSize, maxSize, multiple);
+        }
+        
+        /*! \brief Sets how many queues (streams) the device has. Work on different queues may run concurrently, work on one queue runs in order.
+         Waits for all the work on the device first. The device starts with one queue
+         */
+        void setNumQueues(int count) {
+            wait();
+            while ((int)queues.size() > count) {
+                delete queues.back();
+                queues.pop_back();
+            }
+            while ((int)queues.size() < count) {
+                Queue* queue = new Queue;
+                queue->init(device, context, (int)queues.size());
+                queues.push_back(queue);
+            }
+        }
+        
+        /*! \brief Frees all buffers and all kernels, that the device has created. Their arguments are dropped as well. Waits for all the work on the device first
+         The buffers of initBuffer and createBuffer are not freed, they belong to the caller
+         The memory of the buffers stays in the memory pool for the next addParam calls. Use getMemoryPool().trim() to release it
+         */
         void freeMem() {
-            for (int i = 0; i < buffers.size(); ++i) {
-                buffers[i]->freeMem();
+            wait();
+            for (KernelCache::iterator it = kernels.begin(); it != kernels.end(); ++it)
+                delete it->second;
+            kernels.clear();
+            current = NULL;
+#ifndef CPP11
+            for (size_t i = 0; i < buffers.size(); ++i)
                 delete buffers[i];
-            }
+#endif
             buffers.clear();
-            kernel.freeMem();
-            queue.freeMem();
         }
         
-        void addParam(int param) {
-            kernelLaunch.addArg(param);
+        /// Sets the next argument of the current kernel to a copy of param (int, float, double, int64 or a trivially copyable struct)
+        template <typename T>
+        void addParam(const T& param) {
+            current->launch.addArg(param);
         }
         
-        Buffer* addParam(void* hostSrc, size_t bytes) {
-            Buffer* buf = new Buffer;
-            buf->init(queue.get(), context, hostSrc, bytes);
-            buffers.push_back(buf);
-            kernelLaunch.addArg(*buf);
+        /*! \brief Sets the next argument of the current kernel to a new buffer of bytes, with a copy of hostSrc (if not NULL)
+         \param zeroCopy If true, the buffer uses hostSrc as its memory instead (Buffer::initZeroCopy). There is no allocation and no copy, hostSrc should stay valid until freeMem. Pays off when isHostMemoryShared()
+         \return The buffer, that the device owns. The reference is valid until freeMem, which frees the buffer. To keep a buffer longer, use createBuffer and addParam(Buffer&)
+         */
+        Buffer& addParam(void* hostSrc, size_t bytes, bool zeroCopy = false) {
+#ifdef CPP11
+            buffers.emplace_back();
+            Buffer& buf = buffers.back();
+#else
+            buffers.push_back(new Buffer);
+            Buffer& buf = *buffers.back();
+#endif
+            if (zeroCopy)
+                buf.initZeroCopy(getQueue(), context, hostSrc, bytes);
+            else
+                buf.init(getQueue(), context, hostSrc, bytes, &memoryPool);
+            current->launch.addArg(buf);
             return buf;
         }
         
+        /// Sets the next argument of the current kernel to a buffer, that the device already has (e.g. the output of another kernel)
+        void addParam(Buffer* buffer) {
+            current->launch.addArg(*buffer);
+        }
+        
+        /// Sets the next argument of the current kernel to buffer, e.g. one made with initBuffer. The kernel uses it until it is set again
+        void addParam(Buffer& buffer) {
+            current->launch.addArg(buffer);
+        }
+        
+        /*! \brief Allocates buffer from the memory pool of the device and copies bytes of hostSrc (if not NULL) to it.
+         Unlike the buffers of addParam(void*, size_t), the caller owns it: freeMem does not free it, so it can be bound to any number of kernels and launches (addParam(Buffer&), setParam) and reused for the next job. When it is destroyed (after the work, that uses it, is done), its memory goes back to the pool. It should be destroyed before release (or freeGPAPI)
+         */
+        void initBuffer(Buffer& buffer, const void* hostSrc, size_t bytes) {
+            buffer.init(getQueue(), context, hostSrc, bytes, &memoryPool);
+        }
+#ifdef CPP11
+        
+        /// Same as initBuffer, for a buffer, that is returned by value. Buffers are move-only
+        Buffer createBuffer(const void* hostSrc, size_t bytes) {
+            Buffer buffer;
+            initBuffer(buffer, hostSrc, bytes);
+            return buffer;
+        }
+#endif
+        
+        /*! \brief Sets the next argument of the current kernel to the device buffer of mirror and keeps the two in sync.
+         Each launchKernel first uploads the pages, that the host has changed. If kernelWrites, the whole buffer is then taken as changed by the device, and mirror.read() downloads it. The mirror should outlive the kernel or be replaced with setParam
+         */
+        void addParam(MirroredBuffer& mirror, bool kernelWrites) {
+            current->launch.addArg(mirror.getBuffer());
+            setMirroredArg(current->launch.numParams - 1, &mirror, kernelWrites);
+        }
+        
+        /// Drops all the arguments of the current kernel, so they can be added again from the first one (e.g. for another kernel variant). Waits for its launches on the native target
+        void clearParams() {
+            current->launch.freeMem();
+            current->mirrors.clear();
+        }
+        
+        /// Sets how many work items each thread of the native target takes at a time for the current kernel (see KernelLaunch::chunkSize), 0 for the default. Other targets ignore it
+        void setChunkSize(size_t workItems) {
+            current->launch.chunkSize = workItems;
+        }
+        
+        /// Changes the value of the current kernel argument at index in place. The kernel can be launched again without setKernel and the other arguments stay bound
+        template <typename T>
+        void setParam(int index, const T& param) {
+            current->launch.setArg(index, param);
+        }
+        
+        /// Makes the current kernel argument at index use another buffer, e.g. to swap input and output between launches
+        void setParam(int index, Buffer* buffer) {
+            current->launch.setArg(index, *buffer);
+            setMirroredArg(index, NULL, false);
+        }
+        
+        void setParam(int index, Buffer& buffer) {
+            setParam(index, &buffer);
+        }
+        
+        /// Makes the current kernel argument at index use the device buffer of another mirror (see addParam(MirroredBuffer&, bool))
+        void setParam(int index, MirroredBuffer& mirror, bool kernelWrites) {
+            current->launch.setArg(index, mirror.getBuffer());
+            setMirroredArg(index, &mirror, kernelWrites);
+        }
+        
+        /*! \brief Makes kernelName the kernel, that the next addParam, setParam and launchKernel calls use.
+         The first call for a name creates the kernel. Later calls only switch back to it, with all of its arguments still bound. freeMem drops all kernels
+         */
         void setKernel(const std::string& kernelName){
-            kernel.init(kernelName.c_str(), program);
-            kernelLaunch.init(&kernel);
+            setKernel(kernelName, KernelDefines());
         }
+        
+        /*! \brief Same as setKernel(kernelName), for the variant of the kernel with defines as compile-time constants (e.g. tile sizes), so they are folded and loops with them are unrolled.
+         The first call for a set of defines compiles the source with them (-D name=value), once for all the kernels of the variant. Later calls reuse the program. The native target has no compiler, it uses the variant registered with REGISTER_KERNEL_VARIANT
+         */
+        void setKernel(const std::string& kernelName, const KernelDefines& defines){
+            const std::string definesKey = getDefinesKey(defines);
+            const std::string stateKey = definesKey.empty() ? kernelName : kernelName + " " + definesKey;
+            KernelCache::iterator it = kernels.find(stateKey);
+            if (it == kernels.end()) {
+                KernelState* state = new KernelState;
+                state->kernel.init(kernelName.c_str(), getProgramVariant(defines, definesKey), definesKey.c_str());
+                state->launch.init(&state->kernel);
+                it = kernels.insert(std::make_pair(stateKey, state)).first;
+            }
+            current = it->second;
+        }
+        /// Blocks until the work on all the queues is done. Use Event::wait to wait only for one launch or transfer
         void wait(){
-            kernelLaunch.wait(queue.get(), context);
+            for (size_t i = 0; i < queues.size(); ++i)
+                queues[i]->wait();
         }
         
         
-        ~Device(){
+        /// Frees everything freeMem does, the cached memory and the queues. The device should not be used after that. Called by freeGPAPI, before the context is released
+        void release() {
+            joinPrewarm();
             freeMem();
+            freeVariants();
+            memoryPool.freeMem();
+            freeQueues();
+        }
+        
+        ~Device(){
+            release();
         }
         
         DeviceType getType() const { return deviceType; }
+        /// \return true if the device works on the host memory (the native target and CPU OpenCL devices), so zero-copy buffers save the transfers
+        bool isHostMemoryShared() const {
+#ifdef TARGET_NATIVE
+            return true;
+#else
+            return deviceType == InitParams::VendorParams::CPU;
+#endif
+        }
         VendorType getVendor() const { return vendorType; }
         Platform getPlatform() const { return platform; }
         Context getContext() const { return context; }
         DeviceID getID() const { return device; }
-        Program getProgram() const { return program; }
-        Kernel getKernel() const { return kernel; }
-        GPU_QUEUE getQueue() const { return queue.get();}
+        /// \return The program of the source, NULL if the device compiles lazily and no kernel was set yet
+        Program getProgram() const {
+#ifdef CPP11
+            std::lock_guard<std::mutex> lock(programMutex);
+#endif
+            return program;
+        }
+        /// \return The kernel set with the last setKernel call, NULL if there is none
+        Kernel* getKernel() const { return current ? &current->kernel : NULL; }
+        /// \return The queue at index (0 is the default one), to pass to Buffer methods. Exits with an error if there is no such queue (see setNumQueues)
+        GPU_QUEUE getQueue(int index = 0) const {
+            int err = (index >= 0 && index < (int)queues.size()) ? 0 : -1;
+            if (err)
+                printLog(LogTypeError, "queue %i does not exist, the device has %i queues\n", index, (int)queues.size());
+            CHECK_ERROR(err);
+            return queues[index]->get();
+        }
+        int getNumQueues() const { return (int)queues.size(); }
+        /// \return The pool, that the buffers of addParam take their memory from
+        MemoryPool& getMemoryPool() { return memoryPool; }
         size_t getLocalMemSize() const { return maxLocalMemSize; }
+        /// \return The threadsPerBlock of initGPAPI: the most threads in a block on CUDA and OpenCL, the number of worker threads (cores) on the native target
         size_t getThreadsPerBlock() const { return maxThreadsPerBlock; }
+        /// \return The most work items in a work-group. The same as getThreadsPerBlock on CUDA and OpenCL
+        size_t getMaxGroupSize() const {
+#ifdef TARGET_NATIVE
+            return getNativeDevice()->getMaxGroupSize();
+#else
+            return maxThreadsPerBlock;
+#endif
+        }
     private:
+        /// A kernel and the arguments, that are bound to it
+        struct MirroredArg {
+            int index;
+            MirroredBuffer* buffer;
+            bool kernelWrites;
+        };
+        struct KernelState {
+            Kernel kernel;
+            KernelLaunch launch;
+            /// Arguments, that are synced before each launch
+            std::vector<MirroredArg> mirrors;
+        };
+        typedef std::map<std::string, KernelState*> KernelCache;
+        
+        /// Uploads the host changes of the mirrored arguments of the current kernel, before a launch
+        void syncMirrors() {
+            std::vector<MirroredArg>& mirrors = current->mirrors;
+            for (size_t i = 0; i < mirrors.size(); ++i)
+                mirrors[i].buffer->syncToDevice();
+        }
+        
+        /// Records launch as a use of the mirrored arguments of the current kernel, and as their writer if the kernel writes them
+        void addMirrorsUse(const Event& launch) {
+            std::vector<MirroredArg>& mirrors = current->mirrors;
+            for (size_t i = 0; i < mirrors.size(); ++i) {
+                if (mirrors[i].kernelWrites)
+                    mirrors[i].buffer->markDeviceDirty();
+                mirrors[i].buffer->addUse(launch);
+            }
+        }
+        
+        /// Binds mirror to the current kernel argument at index, or unbinds the mirror there if it is NULL
+        void setMirroredArg(int index, MirroredBuffer* mirror, bool kernelWrites) {
+            std::vector<MirroredArg>& mirrors = current->mirrors;
+            for (size_t i = 0; i < mirrors.size(); ++i) {
+                if (mirrors[i].index == index) {
+                    mirrors.erase(mirrors.begin() + i);
+                    break;
+                }
+            }
+            if (!mirror)
+                return;
+            MirroredArg arg;
+            arg.index = index;
+            arg.buffer = mirror;
+            arg.kernelWrites = kernelWrites;
+            mirrors.push_back(arg);
+        }
+        
+        /// \return The program compiled with defines, compiled now if it is the first use of them
+        Program getProgramVariant(const KernelDefines& defines, const std::string& definesKey) {
+            if (definesKey.empty())
+                return getCompiledProgram();
+            std::map<std::string, Program>::iterator it = variants.find(definesKey);
+            if (it != variants.end())
+                return it->second;
+            Program variant = compileSource(getDefinesOptions(defines), "program variant '" + definesKey + "'");
+            variants.insert(std::make_pair(definesKey, variant));
+            return variant;
+        }
+        
+        /// \return The program of the source, compiled now if the device compiles lazily and it is not compiled yet. Waits for the background compilation, if it is running
+        Program getCompiledProgram() {
+#ifdef CPP11
+            std::lock_guard<std::mutex> lock(programMutex);
+#endif
+            if (!programReady) {
+                InitTimer timer;
+                program = compileSource(std::vector<std::string>(), "program");
+                programReady = true;
+                timer.total("lazy program compilation");
+            }
+            return program;
+        }
+        
+        /// \return The program of the source, compiled with options (-D defines). The native target has no compiler, it returns the program as it is
+        Program compileSource(const std::vector<std::string>& options, const std::string& label) {
+            Program result = program;
+#ifdef TARGET_OPENCL
+            std::string optionsLine;
+            for (size_t i = 0; i < options.size(); ++i)
+                optionsLine += (i ? " " : "") + options[i];
+            result = getOCLProgram(context, device, source, optionsLine.c_str(), programCache, label);
+#endif
+#ifdef TARGET_CUDA
+            result = compileCUDAProgram(context, source, options, programCache);
+            printLog(LogTypeInfo, "%s loaded\n", label.c_str());
+#endif
+            return result;
+        }
+        
+        /// Waits for the background compilation started by init, if there is one
+        void joinPrewarm() {
+#ifdef CPP11
+            if (prewarmThread.joinable())
+                prewarmThread.join();
+#endif
+        }
+        
+        /// Releases the programs of the kernel variants. Their kernels should be freed first
+        void freeVariants() {
+            for (std::map<std::string, Program>::iterator it = variants.begin(); it != variants.end(); ++it) {
+#ifdef TARGET_OPENCL
+                clReleaseProgram(it->second);
+#endif
+#ifdef TARGET_CUDA
+                cuModuleUnload(it->second);
+#endif
+            }
+            variants.clear();
+        }
+        
+        void freeQueues() {
+            for (size_t i = 0; i < queues.size(); ++i)
+                delete queues[i];
+            queues.clear();
+        }
+        
         DeviceType deviceType;
         VendorType vendorType;
         
@@ -85,13 +417,32 @@ namespace GPAPI {
         DeviceID device;
         Context context;
         Program program;
-        Kernel kernel;
-        Queue queue;
-        KernelLaunch kernelLaunch;
+        /// false until program is compiled, if the device compiles lazily
+        bool programReady;
+#ifdef CPP11
+        /// Guards program and programReady against the background compilation
+        mutable std::mutex programMutex;
+        std::thread prewarmThread;
+#endif
+        /// Source of program, the variants are compiled from it
+        std::string source;
+        ProgramCache programCache;
+        /// Programs compiled with defines, by the defines key
+        std::map<std::string, Program> variants;
+        std::vector<Queue*> queues;
+        KernelCache kernels;
+        KernelState* current;
         //
         size_t maxLocalMemSize;
         size_t maxThreadsPerBlock;
         //
+#ifdef CPP11
+        /// Buffers of addParam(void*, size_t). A deque, so adding one does not move the others, that kernels and callers refer to
+        std::deque<Buffer> buffers;
+#else
+        /// Without C++11 buffers cannot be moved into a container, so each one is allocated
         std::vector<Buffer*> buffers;
+#endif
+        MemoryPool memoryPool;
     };
 }
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "common.h"
+#include "native_misc.h"
+
+#include <vector>
+
+#ifdef CPP11
+#   include <atomic>
+#endif
+
+#if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /*! \brief Handle to an asynchronous device operation (e.g. Buffer::uploadAsync or Device::launchKernel).
+     Copies of an Event refer to the same operation. A default constructed Event refers to no operation and is always done.
+     Operations that return an Event also take a list of events (Events), that have to be done before they start.
+     */
+    struct Event {
+        Event() {
+            init();
+        }
+
+        Event(const Event& other) {
+            init();
+            *this = other;
+        }
+
+        Event& operator=(const Event& other) {
+            if (this == &other)
+                return *this;
+            freeMem();
+#ifdef TARGET_OPENCL
+            clEvent = other.clEvent;
+            if (clEvent) {
+                GPU_RESULT err = clRetainEvent(clEvent);
+                CHECK_ERROR(err);
+            }
+#endif
+#ifdef TARGET_CUDA
+            cudaEvent = other.cudaEvent;
+            context = other.context;
+            refs = other.refs;
+            if (refs)
+                ++*refs;
+#endif
+#ifdef TARGET_NATIVE
+            nativeEvent = other.nativeEvent;
+#endif
+            return *this;
+        }
+
+#ifdef TARGET_OPENCL
+        /// Takes ownership of event (e.g. the one returned from clEnqueueWriteBuffer)
+        explicit Event(cl_event event) {
+            init();
+            clEvent = event;
+        }
+
+        cl_event get() const {
+            return clEvent;
+        }
+#endif
+#ifdef TARGET_CUDA
+        /*! \brief Records a new event in stream. It is done when all the work, that was enqueued in the stream before it, is done
+         \param context Should be from the result of Device::getContext() method
+         */
+        static Event record(GPU_STREAM stream, GPU_CONTEXT context) {
+            Event event;
+            pushContext(context);
+            GPU_RESULT err = cuEventCreate(&event.cudaEvent, CU_EVENT_DISABLE_TIMING);
+            CHECK_ERROR(err);
+            err = cuEventRecord(event.cudaEvent, stream);
+            CHECK_ERROR(err);
+            popContext(context);
+            event.context = context;
+            event.refs = new RefCount(1);
+            return event;
+        }
+
+        CUevent get() const {
+            return cudaEvent;
+        }
+#endif
+#ifdef TARGET_NATIVE
+        explicit Event(const std::shared_ptr<NativeEvent>& event) {
+            nativeEvent = event;
+        }
+
+        const std::shared_ptr<NativeEvent>& get() const {
+            return nativeEvent;
+        }
+#endif
+
+        /*! \brief Blocks until the operation is done */
+        void wait() {
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            if (clEvent)
+                err = clWaitForEvents(1, &clEvent);
+#endif
+#ifdef TARGET_CUDA
+            if (cudaEvent) {
+                pushContext(context);
+                err = cuEventSynchronize(cudaEvent);
+                popContext(context);
+            }
+#endif
+#ifdef TARGET_NATIVE
+            if (nativeEvent)
+                nativeEvent->wait();
+#endif
+            CHECK_ERROR(err);
+        }
+
+        /*! \return true if the operation is done. Does not block */
+        bool isDone() {
+            GPU_RESULT err = GPU_SUCCESS;
+            bool done = true;
+#ifdef TARGET_OPENCL
+            if (clEvent) {
+                cl_int status = CL_QUEUED;
+                err = clGetEventInfo(clEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+                CHECK_ERROR(err);
+                done = (status == CL_COMPLETE);
+            }
+#endif
+#ifdef TARGET_CUDA
+            if (cudaEvent) {
+                pushContext(context);
+                err = cuEventQuery(cudaEvent);
+                popContext(context);
+                done = (err == CUDA_SUCCESS);
+                if (err == CUDA_ERROR_NOT_READY)
+                    err = CUDA_SUCCESS;
+            }
+#endif
+#ifdef TARGET_NATIVE
+            if (nativeEvent)
+                done = nativeEvent->isDone();
+#endif
+            CHECK_ERROR(err);
+            return done;
+        }
+
+        /*! \brief Drops the reference to the operation (the operation itself is not canceled). May be called multiple times */
+        void freeMem() {
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            if (clEvent)
+                err = clReleaseEvent(clEvent);
+            clEvent = NULL;
+#endif
+#ifdef TARGET_CUDA
+            if (refs && --*refs == 0) {
+                delete refs;
+                pushContext(context);
+                err = cuEventDestroy(cudaEvent);
+                popContext(context);
+            }
+            refs = NULL;
+            cudaEvent = NULL;
+#endif
+#ifdef TARGET_NATIVE
+            nativeEvent.reset();
+#endif
+            CHECK_ERROR(err);
+        }
+
+        ~Event() {
+            freeMem();
+        }
+    private:
+        void init() {
+#ifdef TARGET_OPENCL
+            clEvent = NULL;
+#endif
+#ifdef TARGET_CUDA
+            cudaEvent = NULL;
+            context = NULL;
+            refs = NULL;
+#endif
+        }
+
+#ifdef TARGET_OPENCL
+        cl_event clEvent;
+#endif
+#ifdef TARGET_CUDA
+        CUevent cudaEvent;
+        GPU_CONTEXT context;
+#ifdef CPP11
+        typedef std::atomic<int> RefCount;
+#else
+        typedef int RefCount;
+#endif
+        ///number of Event objects, that share cudaEvent. Copies of an Event may be made and dropped on different threads
+        RefCount* refs;
+#endif
+#ifdef TARGET_NATIVE
+        std::shared_ptr<NativeEvent> nativeEvent;
+#endif
+    };
+
+    typedef std::vector<Event> Events;
+
+#ifdef TARGET_OPENCL
+    /// \return The OpenCL events of the ones in events, that refer to an operation. Pass size() and the data of the result as an OpenCL wait list (NULL if empty)
+    inline std::vector<cl_event> getWaitList(const Events& events) {
+        std::vector<cl_event> waitList;
+        for (size_t i = 0; i < events.size(); ++i)
+            if (events[i].get())
+                waitList.push_back(events[i].get());
+        return waitList;
+    }
+#endif
+#ifdef TARGET_CUDA
+    /// Makes the work, that is enqueued in stream after this call, wait for all the events. Does not block. Should be called with the context of the stream pushed
+    inline GPU_RESULT streamWaitEvents(GPU_STREAM stream, const Events& events) {
+        GPU_RESULT err = GPU_SUCCESS;
+        for (size_t i = 0; i < events.size() && err == GPU_SUCCESS; ++i)
+            if (events[i].get())
+                err = cuStreamWaitEvent(stream, events[i].get(), 0);
+        return err;
+    }
+#endif
+#ifdef TARGET_NATIVE
+    /// \return The native events of the ones in events, that refer to an operation
+    inline NativeEvents getWaitList(const Events& events) {
+        NativeEvents waitList;
+        for (size_t i = 0; i < events.size(); ++i)
+            if (events[i].get())
+                waitList.push_back(events[i].get());
+        return waitList;
+    }
+#endif
+}
@@ -8,10 +8,6 @@
 #   error GPAPI needs one of CUDA, OpenCL or NATIVE targets to be defined
 #endif
 
-#if __cplusplus >= 201103L
-#   define CPP11
-#endif
-
 #ifdef CPP11
 #   define MOVE std::move
 #else
@@ -23,25 +19,35 @@
 
 #include <algorithm>
 
+#include "event.h"
+#include "memory_pool.h"
 #include "buffer.h"
+#include "buffer_arena.h"
+#include "host_buffer.h"
+#include "mirrored_buffer.h"
+#include "nd_range.h"
+#include "program_cache.h"
 #include "opencl_misc.h"
 #include "cuda_misc.h"
 #include "queue.h"
 #include "kernel.h"
 #include "kernel_launch.h"
 #include "device.h"
+#include "autotuner.h"
+#include "multi_device.h"
 #include "native_misc.h"
 
 namespace GPAPI {
     
     /*! \brief Should be called to init the devices prior any other GPAPI calls. This function should be called exactly once before using GPAPI (and afterward, exactly one call to freeGPAPI should be made in order to release the resources, that GPAPI has allocated)
      \param devices Out param - the inited devices will be stored here.
-     \param source The device source that should be compiled (all devices will be created with this source).
+     \param source The device source that should be compiled (all devices will be created with this source). See InitParams::compileMode for compiling it on the first use of each device instead.
      \param initParams Optional param that can be used to filter which devices should be inited. Please note that in the current GPAPI version, the source might be compiled for all available devices, regardless of this parameter (however, the devices param will have only those devices, which were not filtered by initParams parameter)
     \related freeGPAPI
      */
     template <typename DEVICE>
     inline void initGPAPI(std::vector<DEVICE*>& devices, const::std::string& source, InitParams initParams = InitParams()) {
+        InitTimer timer;
         std::vector<Platform> platformIds;
         std::vector<DeviceID> deviceIds;
         std::vector<Context> contextIds;
@@ -58,21 +64,25 @@ namespace GPAPI {
         initCUDA(platformIds, deviceIds, deviceNames, contextIds, programIds, source, localMemSize, threadsPerBlock, initParams);
 #endif
 #ifdef TARGET_NATIVE
-        platformIds.push_back(0);
-        deviceIds.push_back(0);
-        deviceNames.push_back("NATIVE");
-        contextIds.push_back(0);
-        programIds.push_back(0);
-        threadsPerBlock.push_back(1);
-        localMemSize.push_back(1024 * 1024);
-        printLog(LogTypeInfo, "found device 0 = \"Native\", sharedMem=%i, threadsPerBlock=%i\n", (int)localMemSize[0], (int)threadsPerBlock[0]);
+        for (int i = 0; i < std::max(1, initParams.nativeDevices); ++i) {
+            platformIds.push_back(0);
+            deviceIds.push_back(0);
+            deviceNames.push_back("NATIVE");
+            contextIds.push_back(0);
+            programIds.push_back(0);
+            //the worker threads (cores) run the blocks of the native target; the largest work-group is Device::getMaxGroupSize
+            threadsPerBlock.push_back(getNativeDevice()->getNumThreads());
+            localMemSize.push_back(1024 * 1024);
+            printLog(LogTypeInfo, "found device %i = \"Native\", sharedMem=%i, threadsPerBlock=%i, maxGroupSize=%i\n", i, (int)localMemSize[i], (int)threadsPerBlock[i], (int)getNativeDevice()->getMaxGroupSize());
+        }
 
 #endif
         for (int i = 0; i < deviceIds.size(); ++i) {
             DEVICE* d = new DEVICE;
-            d->init(platformIds[0], deviceIds[i], deviceNames[i], contextIds[i], programIds[i], getVendorType(deviceNames[i]), getDeviceType(deviceNames[i]), localMemSize[i], threadsPerBlock[i]);
+            d->init(platformIds[0], deviceIds[i], deviceNames[i], contextIds[i], programIds[i], getVendorType(deviceNames[i]), getDeviceType(deviceNames[i]), localMemSize[i], threadsPerBlock[i], source, ProgramCache(initParams.programCacheDir, initParams.programCacheMaxBytes), initParams.compileMode);
             devices.push_back(d);
         }
+        timer.total("initGPAPI");
 
         if (!devices.size()) {
             printLog(LogTypeWarning, "No valid devices found\n");
@@ -87,23 +97,27 @@ namespace GPAPI {
         GPU_RESULT err = GPU_SUCCESS;
 #ifdef TARGET_OPENCL
         for (int i = 0; i < devices.size(); ++i) {
-            devices[i]->freeMem();
+            devices[i]->release();
             
             err = clReleaseDevice(devices[i]->getID());
             CHECK_ERROR(err);
             err = clReleaseContext(devices[i]->getContext());
             CHECK_ERROR(err);
-            err = clReleaseProgram(devices[i]->getProgram());
-            CHECK_ERROR(err);
+            if (devices[i]->getProgram()) { //NULL if the device compiles lazily and was never used
+                err = clReleaseProgram(devices[i]->getProgram());
+                CHECK_ERROR(err);
+            }
         }
         
 #endif
 #ifdef TARGET_CUDA
         for (int i = 0; i < devices.size(); ++i) {
-            devices[i]->freeMem();
+            devices[i]->release();
 
-            err = cuModuleUnload(devices[i]->getProgram());
-            CHECK_ERROR(err);
+            if (devices[i]->getProgram()) { //NULL if the device compiles lazily and was never used
+                err = cuModuleUnload(devices[i]->getProgram());
+                CHECK_ERROR(err);
+            }
             err = cuCtxDestroy(devices[i]->getContext());
             CHECK_ERROR(err);
         }
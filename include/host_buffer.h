@@ -0,0 +1,118 @@
+#pragma once
+
+#include "common.h"
+
+#if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+#ifdef TARGET_NATIVE
+#   include <stdlib.h>
+#   ifdef __linux__
+#       include <sys/mman.h>
+#   endif
+#endif
+
+namespace GPAPI {
+    /*! \brief Page-locked (pinned) host memory for fast transfers.
+     Pass get() as the host pointer of Buffer::init, download, uploadAsync and downloadAsync. The driver copies from pinned memory directly, instead of through its own staging copy, and the async transfers really run in the background.
+     On CUDA it is cuMemAllocHost memory, on OpenCL a mapped CL_MEM_ALLOC_HOST_PTR buffer. On the native target it is aligned to huge pages, so big transfers touch fewer TLB entries.
+     */
+    struct HostBuffer {
+        /// Alignment of the native memory, that is big enough for huge pages
+        enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
+        HostBuffer():ptr(NULL), bytes(0) {
+#ifdef TARGET_OPENCL
+            clMem = NULL;
+            queue = NULL;
+#endif
+        }
+
+        /*! \brief Allocates numBytes of pinned host memory
+         \param queueId Should be from the result of Device::getQueue() method. On OpenCL the memory is mapped and unmapped on it
+         \param contextId Should be from the result of Device::getContext() method
+         */
+        void init(GPU_QUEUE queueId, GPU_CONTEXT contextId, size_t numBytes) {
+            freeMem();
+            if (numBytes == 0)
+                return;
+            context = contextId;
+            bytes = numBytes;
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            queue = queueId;
+            clMem = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &err);
+            if (err == GPU_SUCCESS)
+                ptr = clEnqueueMapBuffer(queue, clMem, GPU_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes, 0, NULL, NULL, &err);
+#endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = cuMemAllocHost(&ptr, bytes);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            const size_t alignment = bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 64;
+            err = posix_memalign(&ptr, alignment, (bytes + alignment - 1) / alignment * alignment);
+#   ifdef MADV_HUGEPAGE
+            if (err == GPU_SUCCESS && alignment == HUGE_PAGE_SIZE)
+                madvise(ptr, (bytes + alignment - 1) / alignment * alignment, MADV_HUGEPAGE); //only a hint, the memory works without huge pages as well
+#   endif
+#endif
+            if (err != GPU_SUCCESS)
+                printLog(LogTypeError, "could not allocate %i bytes of pinned host memory\n", (int)bytes);
+            CHECK_ERROR(err);
+        }
+
+        /// \return The host memory, NULL if none is allocated
+        void* get() const {
+            return ptr;
+        }
+
+        size_t getSize() const {
+            return bytes;
+        }
+
+        /// Frees the memory. There should be no transfer from or to it in progress. May be called multiple times
+        void freeMem() {
+            if (!ptr)
+                return;
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            err = clEnqueueUnmapMemObject(queue, clMem, ptr, 0, NULL, NULL);
+            if (err == GPU_SUCCESS)
+                err = clFinish(queue);
+            if (err == GPU_SUCCESS)
+                err = clReleaseMemObject(clMem);
+            clMem = NULL;
+#endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = cuMemFreeHost(ptr);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            ::free(ptr);
+#endif
+            ptr = NULL;
+            bytes = 0;
+            CHECK_ERROR(err);
+        }
+
+        ~HostBuffer() {
+            freeMem();
+        }
+    private:
+        void* ptr;
+        size_t bytes;
+        GPU_CONTEXT context;
+#ifdef TARGET_OPENCL
+        cl_mem clMem;
+        ///the queue, that mapped the memory
+        GPU_QUEUE queue;
+#endif
+
+        HostBuffer(const HostBuffer&);
+        HostBuffer& operator=(const HostBuffer&);
+    };
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdlib>
+#include <string>
+
 namespace GPAPI {
     /*! \class InitParams
      \brief Class used to specialize which devices the user want to init when initGPAPI is called
@@ -85,10 +88,36 @@ namespace GPAPI {
             unsigned other;
         };
         
+        /// When the programs are compiled
+        enum CompileMode {
+            /// In initGPAPI, for all the devices
+            CompileAtInit = 0,
+            /// In the first setKernel of each device, so initGPAPI only finds the devices and creates their contexts
+            CompileOnFirstUse,
+            /// Same as CompileOnFirstUse, and a background thread of each device starts the compilation at once. setKernel waits for it. Needs C++11, otherwise it is CompileOnFirstUse
+            CompileInBackground
+        };
+        
+        /*! Enables all devices. The program cache directory is taken from the GPAPI_PROGRAM_CACHE_DIR environment variable, if it is set
+         */
+        InitParams():programCacheMaxBytes(64 * 1024 * 1024), compileMode(CompileAtInit), nativeDevices(1) {
+            const char* dir = getenv("GPAPI_PROGRAM_CACHE_DIR");
+            if (dir)
+                programCacheDir = dir;
+        }
+        
         VendorParams intel;
         VendorParams nvidia;
         VendorParams amd;
         VendorParams other;
+        /// Directory of the compiled programs cache (see ProgramCache). If empty, the programs are compiled from source on each initGPAPI call
+        std::string programCacheDir;
+        /// Size cap of the files in programCacheDir
+        size_t programCacheMaxBytes;
+        /// When the programs are compiled. Lazy modes cut the time to the first launch, when a worker uses a few kernels of a large source
+        CompileMode compileMode;
+        /// Number of devices, that the native target creates. They share one thread pool, so more than 1 only stands in for several devices (e.g. to try MultiDeviceLaunch without GPUs)
+        int nativeDevices;
         /*! \return 1 if i-th device with vendor and type should be used, 0 otherwise
          */
         int isActive(InitParams::VendorParams::VendorType vendor,
@@ -1,17 +1,61 @@
 #pragma once
 
 #include "common.h"
+#include "native_misc.h"
 
 #if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
 #   error For GPAPI you need only to include gpapi.h
 #endif
 
 namespace GPAPI {
+    /// Compile-time constants of a kernel variant, name to value. The source of the variant is compiled with -D name=value for each of them
+    typedef std::map<std::string, std::string> KernelDefines;
+    
+    /// \return The defines as "name=value" (or only "name" if the value is empty), sorted by name and separated by single spaces. Identifies a variant, e.g. in REGISTER_KERNEL_VARIANT
+    inline std::string getDefinesKey(const KernelDefines& defines) {
+        std::string key;
+        for (KernelDefines::const_iterator it = defines.begin(); it != defines.end(); ++it) {
+            if (!key.empty())
+                key += " ";
+            key += it->second.empty() ? it->first : it->first + "=" + it->second;
+        }
+        return key;
+    }
+    
+    /// \return The defines of key, the inverse of getDefinesKey
+    inline KernelDefines parseDefinesKey(const std::string& key) {
+        KernelDefines defines;
+        size_t begin = 0;
+        while (begin < key.size()) {
+            size_t end = key.find(' ', begin);
+            if (end == std::string::npos)
+                end = key.size();
+            const std::string define = key.substr(begin, end - begin);
+            const size_t equals = define.find('=');
+            if (!define.empty())
+                defines[define.substr(0, equals)] = equals == std::string::npos ? std::string() : define.substr(equals + 1);
+            begin = end + 1;
+        }
+        return defines;
+    }
+    
+    /// \return One compiler option "-Dname=value" (or "-Dname") for each of the defines. OpenCL and NVRTC take the same syntax
+    inline std::vector<std::string> getDefinesOptions(const KernelDefines& defines) {
+        std::vector<std::string> options;
+        for (KernelDefines::const_iterator it = defines.begin(); it != defines.end(); ++it)
+            options.push_back("-D" + (it->second.empty() ? it->first : it->first + "=" + it->second));
+        return options;
+    }
+    
     struct Kernel {
     private:
         GPU_KERNEL kernel;
+        /// Work-group sizes of getGroupSizes, 0 until they are queried
+        size_t targetGroupSize;
+        size_t maxGroupSize;
+        size_t groupSizeMultiple;
     public:
-        Kernel() {kernel=NULL;};
+        Kernel():targetGroupSize(0), maxGroupSize(0), groupSizeMultiple(0) {kernel=NULL;};
         GPU_KERNEL get() {
             return kernel;
         }
@@ -26,13 +70,15 @@ namespace GPAPI {
 #endif
                 kernel = NULL;
             }
+            targetGroupSize = maxGroupSize = groupSizeMultiple = 0;
             CHECK_ERROR(err);
 
         }
         ~Kernel() {
             freeMem();
         }
-        void init(const char* name, GPU_PROGRAM program) {
+        /// \param defines The key (getDefinesKey) of the variant, that program is compiled with. The native target finds the kernel registered for it
+        void init(const char* name, GPU_PROGRAM program, const char* defines = "") {
             freeMem();
             
             if (kernel)
@@ -46,9 +92,65 @@ namespace GPAPI {
 #ifdef TARGET_CUDA
             err = cuModuleGetFunction(&kernel, program, name);
             CHECK_ERROR(err);
+#endif
+#ifdef TARGET_NATIVE
+            kernel = findNativeKernel(name, defines);
+            if (!kernel) {
+                printLog(LogTypeError, "native kernel %s (%s) is not registered\n", name, defines);
+                err = -1;
+            }
 #endif
             CHECK_ERROR(err);
         }
+        
+        /*! \brief The work-group sizes, that suit the kernel on device, for chooseLocalSize. They are queried on the first call and kept
+         \param deviceMaxSize, deviceLocalMem The largest work-group and the local (shared) memory of the device
+         \param targetSize Out param - the size, that runs best with the resources the kernel uses (registers, local memory)
+         \param maxSize Out param - the largest size, that the kernel can be launched with
+         \param multiple Out param - the warp or wavefront size
+         */
+        void getGroupSizes(GPU_DEVICE device, GPU_CONTEXT context, size_t deviceMaxSize, size_t deviceLocalMem, size_t& targetSize, size_t& maxSize, size_t& multiple) {
+            if (!maxGroupSize) {
+                GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+                size_t kernelMax = 0, preferred = 1;
+                cl_ulong localMem = 0;
+                err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelMax), &kernelMax, NULL);
+                if (err == GPU_SUCCESS)
+                    err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(preferred), &preferred, NULL);
+                if (err == GPU_SUCCESS)
+                    err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(localMem), &localMem, NULL);
+                maxGroupSize = std::min(deviceMaxSize, kernelMax);
+                groupSizeMultiple = preferred;
+                //when only a few groups fit in the local memory of a compute unit, each of them should be big to keep it busy
+                targetGroupSize = (localMem && deviceLocalMem / localMem < 4) ? maxGroupSize : 256;
+#endif
+#ifdef TARGET_CUDA
+                int kernelMax = 0, warpSize = 32, minGridSize = 0, bestBlockSize = 0;
+                pushContext(context);
+                err = cuFuncGetAttribute(&kernelMax, CU_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK, kernel);
+                if (err == GPU_SUCCESS)
+                    err = cuDeviceGetAttribute(&warpSize, CU_DEVICE_ATTRIBUTE_WARP_SIZE, device);
+                //the block size with the most resident warps, given the registers and the shared memory the kernel uses
+                if (err == GPU_SUCCESS)
+                    err = cuOccupancyMaxPotentialBlockSize(&minGridSize, &bestBlockSize, kernel, NULL, 0, 0);
+                popContext(context);
+                maxGroupSize = std::min(deviceMaxSize, (size_t)kernelMax);
+                groupSizeMultiple = warpSize;
+                targetGroupSize = bestBlockSize;
+#endif
+#ifdef TARGET_NATIVE
+                //each work item of a group with barriers has its own fiber stack, so native groups are kept small
+                maxGroupSize = deviceMaxSize;
+                groupSizeMultiple = 1;
+                targetGroupSize = 64;
+#endif
+                CHECK_ERROR(err);
+            }
+            targetSize = targetGroupSize;
+            maxSize = maxGroupSize;
+            multiple = groupSizeMultiple;
+        }
     };
 
 }
\ No newline at end of file
@@ -5,25 +5,35 @@
 #endif
 
 #include "common.h"
+#include "nd_range.h"
 #include "native_misc.h"
+#include "event.h"
+
+#include <algorithm>
+#ifdef CPP11
+#   include <type_traits>
+#endif
 
 namespace GPAPI {
+    /*! \brief Kernel and the arguments it is launched with.
+     The arguments stay bound between launches. setArg changes one of them in place, so a kernel can be launched many times with only the changed arguments set again.
+     */
     struct KernelLaunch {
-#if (defined TARGET_CUDA)
-        char paramsBuffer[4096]; // A buffer to hold parameter values
-        void *paramsPtrs[1024]; // A buffer to hold pointers to each parameter
-        int numParams;
-        int paramOffset;
-#endif
-#ifdef TARGET_NATIVE
+        enum { PARAMS_BUFFER_SIZE = 4096, MAX_PARAMS = 256 };
+        union {
+            char paramsBuffer[PARAMS_BUFFER_SIZE]; // A buffer to hold parameter values (on OpenCL, a copy of the last values that were set)
+            double paramsAlignment;
+        };
+        void *paramsPtrs[MAX_PARAMS]; // A buffer to hold pointers to each parameter
+        size_t paramsSizes[MAX_PARAMS]; // Size of each parameter value in paramsBuffer
         int numParams;
-        std::vector<void*> ptrsToDelete;
-        void* ptrs[1024];
-#endif
+        size_t paramOffset;
+        /// Work items in each chunk of a native launch (rounded to whole work-groups), 0 to split the launch evenly over the threads. Other targets ignore it
+        size_t chunkSize;
         
         Kernel* kernel;
-        int index;
-        KernelLaunch():kernel(NULL), index(0) {
+        KernelLaunch():chunkSize(0), kernel(NULL) {
+            freeMem();
         }
         
         void init(Kernel* newKernel) {
@@ -35,68 +45,89 @@ namespace GPAPI {
             
         void addArg(Buffer& buffer) {
             GPU_RESULT err = GPU_SUCCESS;
-#ifdef TARGET_OPENCL
-            err = clSetKernelArg(kernel->get(), index++, sizeof(cl_mem), buffer.get());
-#endif
-#if  (defined TARGET_CUDA)
-            size_t argSize = sizeof(buffer.get());
-                        
-            paramsPtrs[numParams++]=(paramsBuffer+paramOffset);
-            memcpy(paramsBuffer+paramOffset, buffer.get(), argSize);
-            paramOffset+=argSize;
-#endif
 #ifdef TARGET_NATIVE
-            ptrs[numParams] = buffer.get();
-            numParams++;
+            //native kernels get the device pointer itself, not a pointer to it
+            pushParam(0);
+            paramsPtrs[numParams - 1] = buffer.get();
+#else
+            memcpy(pushParam(sizeof(GPU_BUFFER)), buffer.get(), sizeof(GPU_BUFFER));
+#endif
+#ifdef TARGET_OPENCL
+            err = clSetKernelArg(kernel->get(), numParams - 1, sizeof(cl_mem), buffer.get());
 #endif
             CHECK_ERROR(err);
         }
-        void addArg(int arg) {
+        
+        /*! \brief Sets the next kernel argument to a copy of arg. No memory is allocated, the value is kept in the params buffer until freeMem
+         \param arg Should be trivially copyable (int, float, double, int64 or a struct of those) and should match the type of the kernel parameter
+         */
+        template <typename T>
+        void addArg(const T& arg) {
+#ifdef CPP11
+            static_assert(std::is_trivially_copyable<T>::value, "kernel arguments should be trivially copyable");
+#endif
             GPU_RESULT err = GPU_SUCCESS;
+            memcpy(pushParam(sizeof(T)), &arg, sizeof(T));
 #ifdef TARGET_OPENCL
-            err = clSetKernelArg(kernel->get(), index++, sizeof(unsigned int), &arg);
-#endif
-#if  (defined TARGET_CUDA)
-            size_t argSize = sizeof(arg);
-            paramsPtrs[numParams++]=(paramsBuffer+paramOffset);
-            memcpy(paramsBuffer+paramOffset, &arg, argSize);
-            paramOffset+=argSize;
-#endif
-#ifdef TARGET_NATIVE
-            int* newInt = new int;
-            *newInt = arg;
-            ptrs[numParams] = newInt;
-            numParams++;
-            ptrsToDelete.push_back(newInt);
+            err = clSetKernelArg(kernel->get(), numParams - 1, sizeof(T), &arg);
 #endif
             CHECK_ERROR(err);
-
         }
         
-        void run(GPU_QUEUE queue, Context context, size_t& globalSize, size_t& localSize) {
+        /*! \brief Changes the buffer of an argument, that was added with addArg(Buffer&). Does nothing if it is the same buffer
+         \param index Position of the argument, starting from 0
+         */
+        void setArg(int index, Buffer& buffer) {
             GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_NATIVE
+            getParam(index, 0);
+            paramsPtrs[index] = buffer.get();
+#else
+            char* param = getParam(index, sizeof(GPU_BUFFER));
+            if (!memcmp(param, buffer.get(), sizeof(GPU_BUFFER)))
+                return;
+            memcpy(param, buffer.get(), sizeof(GPU_BUFFER));
+#endif
 #ifdef TARGET_OPENCL
-            err = clEnqueueNDRangeKernel(queue, kernel->get(), 1, NULL, &globalSize, &localSize,
-                                         0, NULL, NULL);
+            err = clSetKernelArg(kernel->get(), index, sizeof(cl_mem), buffer.get());
 #endif
-#ifdef TARGET_CUDA
-            pushContext(context);
-            err = cuLaunchKernel(kernel->get(),
-                               (unsigned int)globalSize, 1UL, 1UL, // grid size
-                               (unsigned int)localSize, 1UL, 1UL, // block size
-                               0, // shared size
-                               NULL, // stream
-                               &paramsPtrs[0],
-                               NULL
-                               );
-            popContext(context);
+            CHECK_ERROR(err);
+        }
+        
+        /*! \brief Changes the value of an argument, that was added with addArg. Does nothing if the value is the same
+         \param index Position of the argument, starting from 0
+         \param arg Should have the same type as the value the argument was added with
+         */
+        template <typename T>
+        void setArg(int index, const T& arg) {
+#ifdef CPP11
+            static_assert(std::is_trivially_copyable<T>::value, "kernel arguments should be trivially copyable");
 #endif
-#ifdef TARGET_NATIVE
-            NativeDevice* device = getNativeDevice();
-            device->launchKernel(*this, globalSize * localSize);
+            GPU_RESULT err = GPU_SUCCESS;
+            char* param = getParam(index, sizeof(T));
+            if (!memcmp(param, &arg, sizeof(T)))
+                return;
+            memcpy(param, &arg, sizeof(T));
+#ifdef TARGET_OPENCL
+            err = clSetKernelArg(kernel->get(), index, sizeof(T), &arg);
 #endif
             CHECK_ERROR(err);
         }
+        
+        /*! \brief Starts the kernel with the current arguments on queue, after all the events in waitFor are done. Does not block
+         globalSize is rounded up to a multiple of localSize, so kernels should check their id against the real size
+         \return Event, that is done when the kernel is done
+         */
+        Event run(GPU_QUEUE queue, Context context, size_t globalSize, size_t localSize, const Events& waitFor = Events()) {
+            return run(queue, context, NDRange(globalSize), NDRange(localSize), waitFor);
+        }
+        
+        /*! \brief Same as run, for a launch with 1, 2 or 3 dimensions. Each global size is rounded up to a multiple of the local size
+         \param local Should have the same number of dimensions as global
+         */
+        Event run(GPU_QUEUE queue, Context context, const NDRange& global, const NDRange& local, const Events& waitFor = Events()) {
+            return enqueue(queue, context, global.roundUp(local), local, waitFor);
+        }
         void wait(GPU_QUEUE queue, Context context) {
             GPU_RESULT err = GPU_SUCCESS;
 #ifdef TARGET_OPENCL
@@ -107,25 +138,110 @@ namespace GPAPI {
             err = cuCtxSynchronize();
             CHECK_ERROR(err);
             popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            waitPending();
 #endif
             CHECK_ERROR(err);
         }
         void freeMem() {
 #ifdef TARGET_NATIVE
-            for (int i = 0; i < ptrsToDelete.size(); ++i)
-                delete (char*)ptrsToDelete[i];
-#endif
-            index = 0;
-#if  (defined TARGET_CUDA)
-            numParams = paramOffset = 0;
+            //running launches use their own copy of the arguments, but the buffers they point to should outlive them
+            waitPending();
 #endif
-#if (defined TARGET_NATIVE)
             numParams = 0;
-#endif
+            paramOffset = 0;
         }
         ~KernelLaunch() {
             freeMem();
         }
+    private:
+        /// Starts global work items in groups of local, as they are
+        Event enqueue(GPU_QUEUE queue, Context context, const NDRange& global, const NDRange& local, const Events& waitFor) {
+            Event event;
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            const size_t globalSizes[NDRange::MAX_DIMS] = { global[0], global[1], global[2] };
+            const size_t localSizes[NDRange::MAX_DIMS] = { local[0], local[1], local[2] };
+            std::vector<cl_event> waitList = getWaitList(waitFor);
+            cl_event clEvent;
+            err = clEnqueueNDRangeKernel(queue, kernel->get(), (cl_uint)std::max(1, global.getDims()), NULL, globalSizes, localSizes,
+                                         (cl_uint)waitList.size(), waitList.empty() ? NULL : &waitList[0], &clEvent);
+            if (err == GPU_SUCCESS)
+                event = Event(clEvent);
+#endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = streamWaitEvents(queue, waitFor);
+            if (err == GPU_SUCCESS)
+                err = cuLaunchKernel(kernel->get(),
+                               (unsigned int)((global[0] + local[0] - 1) / local[0]), // grid size
+                               (unsigned int)((global[1] + local[1] - 1) / local[1]),
+                               (unsigned int)((global[2] + local[2] - 1) / local[2]),
+                               (unsigned int)local[0], (unsigned int)local[1], (unsigned int)local[2], // block size
+                               0, // shared size
+                               queue, // stream
+                               &paramsPtrs[0],
+                               NULL
+                               );
+            popContext(context);
+            if (err == GPU_SUCCESS)
+                event = Event::record(queue, context);
+#endif
+#ifdef TARGET_NATIVE
+            NativeDevice* device = getNativeDevice();
+            event = Event(device->launchKernel(*this, global, local, getWaitList(waitFor), queue));
+            //keep only the launches, that are not done yet, so wait has something to wait for
+            for (size_t i = 0; i < pending.size(); )
+                if (pending[i].isDone()) {
+                    pending[i] = pending.back();
+                    pending.pop_back();
+                } else {
+                    ++i;
+                }
+            pending.push_back(event);
+#endif
+            CHECK_ERROR(err);
+            return event;
+        }
+        
+        /// Reserves size bytes in the params buffer and adds a pointer to them as the next parameter. \return The reserved bytes
+        char* pushParam(size_t size) {
+            //align to the lowest set bit of the size, which is the alignment of all scalars and of most structs
+            const size_t alignment = size ? std::min(size & (~size + 1), sizeof(double)) : 1;
+            const size_t offset = (paramOffset + alignment - 1) / alignment * alignment;
+            
+            int err = (numParams < MAX_PARAMS && offset + size <= PARAMS_BUFFER_SIZE) ? 0 : -1;
+            if (err)
+                printLog(LogTypeError, "kernel arguments do not fit in %i params, %i bytes\n", (int)MAX_PARAMS, (int)PARAMS_BUFFER_SIZE);
+            CHECK_ERROR(err);
+            
+            paramsPtrs[numParams] = paramsBuffer + offset;
+            paramsSizes[numParams] = size;
+            ++numParams;
+            paramOffset = offset + size;
+            return paramsBuffer + offset;
+        }
+        
+        /// \return The value of the parameter at index, that should have been added with the same size
+        char* getParam(int index, size_t size) {
+            int err = (index >= 0 && index < numParams && paramsSizes[index] == size) ? 0 : -1;
+            if (err)
+                printLog(LogTypeError, "kernel argument %i is not set or has a different type\n", index);
+            CHECK_ERROR(err);
+            
+            return (char*)paramsPtrs[index];
+        }
+#ifdef TARGET_NATIVE
+        void waitPending() {
+            for (size_t i = 0; i < pending.size(); ++i)
+                pending[i].wait();
+            pending.clear();
+        }
+
+        /// Launches of this kernel, that may still run
+        Events pending;
+#endif
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "common.h"
+
+#if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /*! \brief Caches device memory for reuse. Each Device has one and the buffers it creates draw from it.
+     Freed memory goes to the bin of its size class instead of back to the driver, so the next allocation of the same class takes it from there.
+     Sizes are rounded up to one of four classes per power of two, so at most a quarter of an allocation is unused.
+     Not thread safe, like the Device that owns it.
+     */
+    struct MemoryPool {
+#ifdef TARGET_OPENCL
+        typedef cl_mem Memory;
+#endif
+#ifdef TARGET_CUDA
+        typedef CUdeviceptr Memory;
+#endif
+#ifdef TARGET_NATIVE
+        typedef void* Memory;
+#endif
+        enum { MIN_SIZE_CLASS = 256 };
+        /// Default limit of the cached bytes (see setMaxCachedBytes)
+        static const size_t DEFAULT_MAX_CACHED_BYTES = size_t(256) * 1024 * 1024;
+
+        struct Stats {
+            size_t hits; ///< allocations taken from the cache
+            size_t misses; ///< allocations that went to the driver
+            size_t bytesCached; ///< bytes that are freed, but not released to the driver
+            size_t bytesInUse; ///< bytes that are allocated and not freed yet (rounded up to the size class)
+        };
+
+        MemoryPool():context(), maxCachedBytes(DEFAULT_MAX_CACHED_BYTES) {
+            memset(&stats, 0, sizeof(stats));
+        }
+
+        void init(GPU_CONTEXT contextId) {
+            freeMem();
+            context = contextId;
+        }
+
+        /// \return Device memory of at least bytes. Should be returned with free, with the same bytes
+        Memory alloc(size_t bytes) {
+            const size_t size = getSizeClass(bytes);
+            stats.bytesInUse += size;
+            Bins::iterator bin = bins.find(size);
+            if (bin != bins.end() && !bin->second.empty()) {
+                Memory memory = bin->second.back();
+                bin->second.pop_back();
+                stats.bytesCached -= size;
+                ++stats.hits;
+                return memory;
+            }
+            ++stats.misses;
+            return allocate(size);
+        }
+
+        /// Keeps memory for the next alloc of the same size class. If the cache would grow over the limit, memory is released instead
+        void free(Memory memory, size_t bytes) {
+            const size_t size = getSizeClass(bytes);
+            stats.bytesInUse -= size;
+            if (stats.bytesCached + size > maxCachedBytes) {
+                release(memory);
+                return;
+            }
+            bins[size].push_back(memory);
+            stats.bytesCached += size;
+        }
+
+        /// Sets the high-water mark of the cache. Memory over it is released right away
+        void setMaxCachedBytes(size_t bytes) {
+            maxCachedBytes = bytes;
+            trim(bytes);
+        }
+
+        /// Releases cached memory, the biggest first, until at most keepBytes stay cached
+        void trim(size_t keepBytes = 0) {
+            for (Bins::reverse_iterator bin = bins.rbegin(); bin != bins.rend() && stats.bytesCached > keepBytes; ++bin) {
+                while (!bin->second.empty() && stats.bytesCached > keepBytes) {
+                    release(bin->second.back());
+                    bin->second.pop_back();
+                    stats.bytesCached -= bin->first;
+                }
+            }
+        }
+
+        const Stats& getStats() const {
+            return stats;
+        }
+
+        /// Releases all cached memory. The memory that is still in use is not affected
+        void freeMem() {
+            trim(0);
+            bins.clear();
+        }
+
+        ~MemoryPool() {
+            freeMem();
+        }
+
+        /// \return The size, that an allocation of bytes really takes: a multiple of a quarter of the biggest power of two, that is below bytes
+        static size_t getSizeClass(size_t bytes) {
+            if (bytes <= MIN_SIZE_CLASS)
+                return MIN_SIZE_CLASS;
+            size_t power = MIN_SIZE_CLASS;
+            while (power * 2 < bytes)
+                power *= 2;
+            const size_t step = power / 4;
+            return (bytes + step - 1) / step * step;
+        }
+    private:
+        Memory allocate(size_t bytes) {
+            Memory memory = Memory();
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            memory = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+#endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = cuMemAlloc(&memory, bytes);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            memory = new char[bytes];
+#endif
+            CHECK_ERROR(err);
+            return memory;
+        }
+
+        void release(Memory memory) {
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            err = clReleaseMemObject(memory);
+#endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = cuMemFree(memory);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            delete[] (char*)memory;
+#endif
+            CHECK_ERROR(err);
+        }
+
+        typedef std::map<size_t, std::vector<Memory> > Bins;
+        Bins bins;
+        GPU_CONTEXT context;
+        size_t maxCachedBytes;
+        Stats stats;
+
+        MemoryPool(const MemoryPool&);
+        MemoryPool& operator=(const MemoryPool&);
+    };
+}
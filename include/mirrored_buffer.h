@@ -0,0 +1,187 @@
+#pragma once
+
+#include "common.h"
+#include "buffer.h"
+#include "event.h"
+
+#if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /*! \brief Host memory and a device Buffer with the same data, kept in sync lazily.
+     Writes are tracked in pages of PAGE_SIZE bytes. Host writes are marked by write or markHostDirty, device writes by markDeviceDirty. If a page is written on both sides, the last writer wins.
+     syncToDevice and syncToHost transfer only the dirty pages, neighbouring pages in one transfer.
+     Bound with Device::addParam(MirroredBuffer&, bool), the buffer is synced to the device before each launch and its pages are marked as written by the kernel after it. read syncs to the host.
+     */
+    struct MirroredBuffer {
+        enum { PAGE_SIZE = 4096 };
+
+        MirroredBuffer():host(NULL), bytes(0), uploadedBytes(0), downloadedBytes(0) {
+        }
+
+        /*! \brief Allocates the device buffer
+         \param queueId, contextId Should be from the results of Device::getQueue() and Device::getContext() methods. The syncs are made on this queue
+         \param hostPtr The host memory. All of it is sent to the device with the first sync. If NULL, the buffer allocates its own host memory and neither side has defined data
+         \param memoryPool If not NULL, the device memory is taken from it
+         */
+        void init(GPU_QUEUE queueId, GPU_CONTEXT contextId, void* hostPtr, size_t numBytes, MemoryPool* memoryPool = NULL) {
+            freeMem();
+            queue = queueId;
+            context = contextId;
+            bytes = numBytes;
+            if (hostPtr) {
+                host = (char*)hostPtr;
+            } else {
+                ownHost.resize(numBytes);
+                host = ownHost.empty() ? NULL : &ownHost[0];
+            }
+            device.init(queue, context, NULL, numBytes, memoryPool);
+            const size_t numPages = (numBytes + PAGE_SIZE - 1) / PAGE_SIZE;
+            hostDirty.assign(numPages, hostPtr ? 1 : 0);
+            deviceDirty.assign(numPages, 0);
+        }
+
+        /// Copies count bytes of src to the host memory at offset and marks them. The pages, that the device changed, are synced first, so the rest of them is not lost
+        void write(size_t offset, const void* src, size_t count) {
+            if (!count)
+                return;
+            sync(deviceDirty, false, offset / PAGE_SIZE, (offset + count - 1) / PAGE_SIZE + 1);
+            memcpy(host + offset, src, count);
+            markHostDirty(offset, count);
+        }
+
+        /// Marks bytes, that were written directly to the host memory. Their pages should not have unsynced device changes (read them first)
+        void markHostDirty(size_t offset, size_t count) {
+            mark(hostDirty, deviceDirty, offset, count);
+        }
+
+        /// Marks bytes, that a kernel has written
+        void markDeviceDirty(size_t offset, size_t count) {
+            mark(deviceDirty, hostDirty, offset, count);
+        }
+
+        void markDeviceDirty() {
+            markDeviceDirty(0, bytes);
+        }
+
+        /// Uploads the pages, that the host has changed
+        void syncToDevice() {
+            sync(hostDirty, true, 0, hostDirty.size());
+        }
+
+        /// Downloads the pages, that the device has changed. Waits for the work on the queue first
+        void syncToHost() {
+            sync(deviceDirty, false, 0, deviceDirty.size());
+        }
+
+        /// Records a launch, that reads or writes the device buffer. The syncs wait for it before they transfer, also when it runs on another queue
+        void addUse(const Event& launch) {
+            for (size_t i = 0; i < uses.size(); )
+                if (uses[i].isDone())
+                    uses.erase(uses.begin() + i);
+                else
+                    ++i;
+            uses.push_back(launch);
+        }
+
+        /// \return The host memory with the latest data
+        const void* read() {
+            syncToHost();
+            return host;
+        }
+
+        /// \return The host memory as it is, without syncing. Mark what is written with markHostDirty
+        void* getHost() {
+            return host;
+        }
+
+        /// \return The device buffer as it is, without syncing
+        Buffer& getBuffer() {
+            return device;
+        }
+
+        size_t getSize() const {
+            return bytes;
+        }
+
+        /// \return Number of bytes sent to the device so far
+        size_t getUploadedBytes() const {
+            return uploadedBytes;
+        }
+
+        /// \return Number of bytes read from the device so far
+        size_t getDownloadedBytes() const {
+            return downloadedBytes;
+        }
+
+        void freeMem() {
+            device.freeMem();
+            ownHost.clear();
+            hostDirty.clear();
+            deviceDirty.clear();
+            uses.clear();
+            host = NULL;
+            bytes = 0;
+        }
+
+        ~MirroredBuffer() {
+            freeMem();
+        }
+    private:
+        /// Marks the pages of [offset, offset + count) in dirty. The other side loses them, the last writer wins
+        void mark(std::vector<unsigned char>& dirty, std::vector<unsigned char>& other, size_t offset, size_t count) {
+            if (!count)
+                return;
+            const size_t last = (offset + count - 1) / PAGE_SIZE;
+            for (size_t page = offset / PAGE_SIZE; page <= last && page < dirty.size(); ++page) {
+                dirty[page] = 1;
+                other[page] = 0;
+            }
+        }
+
+        /// Transfers the dirty pages in [firstPage, endPage) and clears them. A run of neighbouring pages goes in one transfer
+        void sync(std::vector<unsigned char>& dirty, bool toDevice, size_t firstPage, size_t endPage) {
+            endPage = std::min(endPage, dirty.size());
+            for (size_t page = firstPage; page < endPage; ) {
+                if (!dirty[page]) {
+                    ++page;
+                    continue;
+                }
+                for (size_t i = 0; i < uses.size(); ++i)
+                    uses[i].wait();
+                uses.clear();
+                const size_t runBegin = page;
+                while (page < endPage && dirty[page])
+                    dirty[page++] = 0;
+                const size_t offset = runBegin * PAGE_SIZE;
+                const size_t count = std::min(page * PAGE_SIZE, bytes) - offset;
+                if (toDevice) {
+                    device.upload(queue, context, host + offset, count, offset);
+                    uploadedBytes += count;
+                } else {
+                    device.download(queue, context, host + offset, count, offset);
+                    downloadedBytes += count;
+                }
+            }
+        }
+
+        GPU_QUEUE queue;
+        GPU_CONTEXT context;
+        char* host;
+        ///the host memory, if the caller did not give any
+        std::vector<char> ownHost;
+        size_t bytes;
+        Buffer device;
+        ///one flag for each page, 1 if the page has changes, that the other side does not have
+        std::vector<unsigned char> hostDirty;
+        std::vector<unsigned char> deviceDirty;
+        ///launches, that may still use the device buffer
+        Events uses;
+        size_t uploadedBytes;
+        size_t downloadedBytes;
+
+        MirroredBuffer(const MirroredBuffer&);
+        MirroredBuffer& operator=(const MirroredBuffer&);
+    };
+}
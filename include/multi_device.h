@@ -0,0 +1,204 @@
+#pragma once
+
+#include "common.h"
+
+#ifndef __GPAPI_H__
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /// \brief The part of a MultiDeviceLaunch, that one device runs: work items [offset, offset + count) and the slices of the arrays for them
+    struct DeviceSlice {
+        Device* device;
+        size_t offset;
+        size_t count;
+        /// One buffer for each array of the launch, in the order they were added, with only the items of this slice. The MultiDeviceLaunch owns them, they are valid during bind
+        std::vector<Buffer*> buffers;
+    };
+
+    /*! \brief Runs one 1D launch over several devices at once: the work items and the arrays they use are split in contiguous slices, one for each device.
+     The slices are weighted by the throughput each device had in the previous runs (equal on the first run), so a fast and a slow device finish at about the same time.
+     Each device uploads its slices of the inputs, runs the kernel over its items and downloads its slices of the outputs, on a thread of its own (with C++11, otherwise one device after another).
+     The kernel should use work item i only with item i of the arrays (e.g. vecAdd), as each device sees only its slice with ids from 0.
+     The buffers of the slices are kept for the next run and made again only when the size of a slice changes. The launch should be destroyed before freeGPAPI, as it frees them
+     */
+    struct MultiDeviceLaunch {
+        /// \param launchDevices The devices to split the launches over, e.g. the ones of initGPAPI
+        MultiDeviceLaunch(const std::vector<Device*>& launchDevices):devices(launchDevices), throughput(launchDevices.size(), 0), granularity(1)
+#ifdef CPP11
+            , sliceBuffers(launchDevices.size())
+#endif
+        {
+        }
+
+        /// Adds an array of bytesPerItem bytes for each work item, that is uploaded to the devices. host should stay valid during run
+        void addInput(const void* host, size_t bytesPerItem) {
+            addArray((void*)host, bytesPerItem, true, false);
+        }
+
+        /// Adds an array of bytesPerItem bytes for each work item, that the kernel writes. It is downloaded to host after the launch
+        void addOutput(void* host, size_t bytesPerItem) {
+            addArray(host, bytesPerItem, false, true);
+        }
+
+        /// Adds an array, that is both uploaded and downloaded
+        void addInputOutput(void* host, size_t bytesPerItem) {
+            addArray(host, bytesPerItem, true, true);
+        }
+
+        /// Each slice (but the last one) gets a multiple of items work items, e.g. the work-group size
+        void setGranularity(size_t items) {
+            granularity = std::max<size_t>(items, 1);
+        }
+
+        /// Sets the relative speed of each device (e.g. the getWeights of an earlier run), instead of the measured one. 0 gives the device no items
+        void setWeights(const std::vector<double>& weights) {
+            throughput = weights;
+            throughput.resize(devices.size(), 0);
+        }
+
+        /// \return Work items per millisecond of each device in the last runs, 0 for the devices, that did not run yet
+        const std::vector<double>& getWeights() const {
+            return throughput;
+        }
+
+        /// \return Slices of numItems work items for the devices, by their weights. A device with no items gets an empty slice
+        std::vector<DeviceSlice> split(size_t numItems) const {
+            double total = 0;
+            for (size_t i = 0; i < devices.size(); ++i)
+                total += throughput[i];
+            std::vector<DeviceSlice> slices(devices.size());
+            size_t offset = 0;
+            double weightSum = 0;
+            for (size_t i = 0; i < devices.size(); ++i) {
+                //the slices end at the rounded running sum of the weights, so the rounding errors do not add up
+                weightSum += total > 0 ? throughput[i] : 1;
+                size_t end = numItems;
+                if (i + 1 < devices.size()) {
+                    const double share = weightSum / (total > 0 ? total : devices.size());
+                    end = std::min(numItems, (size_t)(share * numItems / granularity + 0.5) * granularity);
+                }
+                slices[i].device = devices[i];
+                slices[i].offset = offset;
+                slices[i].count = std::max(end, offset) - offset;
+                offset += slices[i].count;
+            }
+            return slices;
+        }
+
+        /*! \brief Runs kernelName over numItems work items, split over the devices, and waits until all the outputs are downloaded. Then updates the weights from how long each device took
+         \param bind Functor, that adds the arguments of the kernel: bind(device, slice) is called after setKernel, e.g. to add slice.buffers and slice.count. It runs on the thread of the device
+         */
+        template <typename BIND>
+        void run(const std::string& kernelName, size_t numItems, BIND& bind) {
+            std::vector<DeviceSlice> slices = split(numItems);
+            std::vector<double> times(devices.size(), 0);
+            RunSlice<BIND> task(*this, kernelName, slices, times, bind);
+#ifdef CPP11
+            //a thread for each device, not parallelFor: the threads mostly wait for their devices, so there should be more of them than cores
+            std::vector<std::thread> threads;
+            for (int i = 0; i < (int)devices.size(); ++i)
+                threads.push_back(std::thread([&task, i]() { task(i); }));
+            for (size_t i = 0; i < threads.size(); ++i)
+                threads[i].join();
+#else
+            for (int i = 0; i < (int)devices.size(); ++i)
+                task(i);
+#endif
+
+            std::string log;
+            for (size_t i = 0; i < devices.size(); ++i) {
+                if (!slices[i].count)
+                    continue;
+                //average with the earlier runs, so one slow run does not move all the work away
+                const double itemsPerMs = slices[i].count / std::max(times[i], 0.001);
+                throughput[i] = throughput[i] > 0 ? (throughput[i] + itemsPerMs) / 2 : itemsPerMs;
+                char text[128];
+                snprintf(text, sizeof(text), " %s: %i items %.1f ms", devices[i]->name.c_str(), (int)slices[i].count, times[i]);
+                log += text;
+            }
+            printLog(LogTypeInfo, "%s on %i devices:%s\n", kernelName.c_str(), (int)devices.size(), log.c_str());
+        }
+    private:
+        struct Array {
+            char* host;
+            size_t bytesPerItem;
+            bool upload;
+            bool download;
+        };
+
+        /// Runs the slice of one device on its thread
+        template <typename BIND>
+        struct RunSlice {
+            RunSlice(MultiDeviceLaunch& multiLaunch, const std::string& kernel, std::vector<DeviceSlice>& deviceSlices, std::vector<double>& deviceTimes, BIND& bindArgs)
+                :launch(multiLaunch), kernelName(kernel), slices(deviceSlices), times(deviceTimes), bind(bindArgs) {
+            }
+
+            void operator()(int i) {
+                DeviceSlice& slice = slices[i];
+                if (!slice.count)
+                    return;
+                Device& device = *slice.device;
+                const double start = InitTimer::now();
+#ifdef CPP11
+                std::vector<Buffer>& buffers = launch.sliceBuffers[i];
+                buffers.resize(launch.arrays.size());
+#endif
+                for (size_t a = 0; a < launch.arrays.size(); ++a) {
+                    const Array& array = launch.arrays[a];
+                    const char* hostSrc = array.upload ? array.host + slice.offset * array.bytesPerItem : NULL;
+                    const size_t bytes = slice.count * array.bytesPerItem;
+#ifdef CPP11
+                    if (buffers[a].getSize() != bytes)
+                        buffers[a] = device.createBuffer(hostSrc, bytes);
+                    else if (hostSrc)
+                        buffers[a].upload(device.getQueue(), device.getContext(), hostSrc, bytes);
+                    slice.buffers.push_back(&buffers[a]);
+#else
+                    //without C++11 Buffer cannot be kept in a vector, so the buffers are made for each run
+                    slice.buffers.push_back(new Buffer);
+                    device.initBuffer(*slice.buffers.back(), hostSrc, bytes);
+#endif
+                }
+                device.setKernel(kernelName);
+                device.clearParams();
+                bind(device, slice);
+                device.launchKernel(NDRange(slice.count)).wait();
+                for (size_t a = 0; a < launch.arrays.size(); ++a) {
+                    const Array& array = launch.arrays[a];
+                    if (array.download)
+                        slice.buffers[a]->download(device.getQueue(), device.getContext(), array.host + slice.offset * array.bytesPerItem, slice.count * array.bytesPerItem);
+                }
+                times[i] = InitTimer::now() - start;
+                //drop the arguments first, as they point to the buffers
+                device.clearParams();
+#ifndef CPP11
+                for (size_t a = 0; a < slice.buffers.size(); ++a)
+                    delete slice.buffers[a];
+#endif
+                slice.buffers.clear();
+            }
+
+            MultiDeviceLaunch& launch;
+            const std::string& kernelName;
+            std::vector<DeviceSlice>& slices;
+            std::vector<double>& times;
+            BIND& bind;
+        };
+
+        void addArray(void* host, size_t bytesPerItem, bool upload, bool download) {
+            Array array = { (char*)host, bytesPerItem, upload, download };
+            arrays.push_back(array);
+        }
+
+        std::vector<Device*> devices;
+        std::vector<Array> arrays;
+        /// Work items per millisecond of each device
+        std::vector<double> throughput;
+        size_t granularity;
+#ifdef CPP11
+        /// Buffers of the slice of each device, one for each array, from the last run
+        std::vector<std::vector<Buffer> > sliceBuffers;
+#endif
+    };
+}
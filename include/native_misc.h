@@ -3,17 +3,207 @@
 
 #include "configure.h"
 #include "common.h"
+#include "nd_range.h"
+
+#ifdef TARGET_NATIVE
+#   include <condition_variable>
+#   include <functional>
+#   include <memory>
+#   include <mutex>
+#   include <type_traits>
+#   include <vector>
+#endif
 
 namespace GPAPI {
 #ifdef TARGET_NATIVE
 
     struct KernelLaunch;
-    
+
+    /// \brief Completion state of an asynchronous native operation. Shared by the operation and all the Event objects, that refer to it
+    struct NativeEvent {
+        NativeEvent();
+        /// Marks the operation as done and wakes up the threads, that wait for it
+        void signal();
+        /// Blocks until signal is called
+        void wait();
+        bool isDone();
+        /// Calls action after the event is signaled, on the thread that signals it. If the event is already done, action is called right away
+        void then(const std::function<void()>& action);
+    private:
+        std::mutex lock;
+        std::condition_variable doneSignal;
+        bool done;
+        std::vector<std::function<void()> > continuations;
+    };
+
+    typedef std::vector<std::shared_ptr<NativeEvent> > NativeEvents;
+
+    /// Calls action once all the events are done. Does not block
+    void whenAll(const NativeEvents& events, const std::function<void()>& action);
+
+    /*! \brief In-order native queue (stream). Each operation on it starts after the one enqueued before it, operations on different queues run concurrently.
+     Each queue is a lane of the thread pool: the chunks of its launches are handed out starting from the worker with the same index, so concurrent queues start on different workers.
+     */
+    struct NativeQueue {
+        explicit NativeQueue(size_t lane);
+        /// Blocks until all the operations on the queue are done
+        void wait();
+    private:
+        friend struct NativeDevice;
+        size_t lane;
+        std::mutex lock;
+        /// The operation enqueued last, NULL if there is none
+        std::shared_ptr<NativeEvent> last;
+    };
+
+    /*! \brief Execution context of the work item, that the current thread runs.
+     Each thread that runs native kernels has its own copy, filled by the launcher before each work item. The kernel reads it through globalID(), localID() and the other kernel.cl functions.
+     */
+    struct NativeWorkItem {
+        size_t globalID;
+        size_t localID;
+        size_t groupID;
+        size_t globalSize;
+        size_t localSize;
+        size_t numGroups;
+        /// FOR_EACH_ITEM runs the work items [globalID, loopEnd) in one loop
+        size_t loopEnd;
+        /// Set by FOR_EACH_ITEM, so the launcher knows the work items up to loopEnd are done
+        bool looped;
+        /// Number of dimensions of the launch. With more than one, the 1D id functions return the ids in the first dimension, like on a GPU
+        int dims;
+        /// Sizes of each dimension of the launch, 1 for the dimensions it does not have. The ids in each dimension are decoded from globalID, groups and items in a group are ordered with the first dimension fastest
+        size_t globalSizes[NDRange::MAX_DIMS];
+        size_t localSizes[NDRange::MAX_DIMS];
+        size_t groupCounts[NDRange::MAX_DIMS];
+    };
+
+    /*! \brief Runs native kernels on a persistent pool of worker threads (one per core, or as many as the GPAPI_NATIVE_THREADS environment variable sets).
+
+     The work items of a launch are split into chunks of whole work-groups. The chunks are spread over per-worker queues and idle workers steal from the others.
+     Launches are asynchronous. Each of them gets a NativeEvent, that is signaled after its last chunk is done. A launch, that has to wait for other events, is queued only after they are done.
+     All work items of a work-group run on the same thread. The first work item runs as a plain call. Only if it reaches a MEMORY_BARRIER, the others run as fibers and the barriers switch between them, so kernels without barriers make no context switches.
+     SHARED variables are thread_local, so all the work items of a group see the same copy.
+     If the kernel uses FOR_EACH_ITEM, its first work item runs the whole chunk in one loop, that the compiler can vectorize.
+     */
     struct NativeDevice {
-        void launchKernel(KernelLaunch& kernelLaunch, size_t numTasks);
+        NativeDevice();
+        ~NativeDevice();
+        /*! \brief Starts the global work items of the kernel set in kernelLaunch, after all the events in waitFor are done. Does not block
+         The arguments are copied, so kernelLaunch may be changed or launched again right away.
+         \param global With more than one dimension, each of its sizes should be a multiple of the local size. A 1D launch may end with a smaller group
+         \param local Size of a work-group. The work items of a group are consecutive. It should not have more than getMaxGroupSize() items
+         \param queue If not NULL, the launch also waits for the previous operation on the queue
+         \return Event, that is signaled after all the work items are done
+         */
+        std::shared_ptr<NativeEvent> launchKernel(KernelLaunch& kernelLaunch, const NDRange& global, const NDRange& local, const NativeEvents& waitFor, NativeQueue* queue);
+        /// \return Number of threads that execute the work items
+        size_t getNumThreads() const;
+        /// \return Maximum number of work items in a work-group
+        size_t getMaxGroupSize() const;
+        /*! \brief Copies bytes from src to dst on a background copy thread, after all the events in waitFor are done. Copies run one after the other, in the order they become ready
+         \param queue If not NULL, the copy also waits for the previous operation on the queue
+         \return Event, that is signaled after the copy is done. src and dst should stay valid until then
+         */
+        std::shared_ptr<NativeEvent> copyAsync(void* dst, const void* src, size_t bytes, const NativeEvents& waitFor, NativeQueue* queue);
+        /// Largest pattern of fillAsync (the same as the OpenCL limit)
+        enum { MAX_FILL_PATTERN_SIZE = 128 };
+        /*! \brief Fills bytes of dst with copies of pattern on the copy thread, in order with the copies. Like copyAsync, but bytes should be a multiple of patternSize
+         \return Event, that is signaled after the fill is done
+         */
+        std::shared_ptr<NativeEvent> fillAsync(void* dst, const void* pattern, size_t patternSize, size_t bytes, const NativeEvents& waitFor, NativeQueue* queue);
+    private:
+        /// Queues a copy (src is not NULL) or a fill on the copy thread, after waitFor and the last operation on queue
+        std::shared_ptr<NativeEvent> pushCopy(void* dst, const void* src, size_t bytes, const void* pattern, size_t patternSize, const NativeEvents& waitFor, NativeQueue* queue);
+        struct ThreadPool;
+        ThreadPool* pool;
+        struct CopyThread;
+        CopyThread* copies;
+
+        NativeDevice(const NativeDevice&);
+        NativeDevice& operator=(const NativeDevice&);
     };
-    
+
     NativeDevice* getNativeDevice();
-    
+
+    /// \brief Native kernel, registered with REGISTER_KERNEL or REGISTER_KERNEL_VARIANT
+    struct NativeKernelInfo {
+        /// Calls the kernel with the arguments, that args points to
+        typedef void (*Invoke)(void* const* args);
+
+        const char* name;
+        /// Key of the defines of the variant (see getDefinesKey), empty for REGISTER_KERNEL
+        const char* defines;
+        Invoke invoke;
+        int numArgs;
+        /// sizeof of the type of each argument
+        const size_t* argSizes;
+        /// Whether each argument is a pointer, that takes a buffer, instead of a value
+        const bool* argIsPointer;
+    };
+
+    /// \return The kernel registered with this name and defines key, NULL if there is no such kernel
+    const NativeKernelInfo* findNativeKernel(const char* name, const char* defines = "");
+
+    /// \brief Adds a kernel to the ones findNativeKernel knows. REGISTER_KERNEL creates one static instance for each kernel, REGISTER_KERNEL_VARIANT one for each variant
+    struct NativeKernelRegistrar {
+        NativeKernelRegistrar(const char* name, NativeKernelInfo::Invoke invoke, int numArgs, const size_t* argSizes, const bool* argIsPointer, const char* defines = "");
+    };
+
+    template <size_t... I>
+    struct NativeArgIndices {};
+
+    template <size_t N, size_t... I>
+    struct MakeNativeArgIndices : MakeNativeArgIndices<N - 1, N - 1, I...> {};
+
+    template <size_t... I>
+    struct MakeNativeArgIndices<0, I...> {
+        typedef NativeArgIndices<I...> Type;
+    };
+
+    /// Buffer arguments are stored as the device pointer itself, all other arguments as a pointer to their value
+    template <typename T>
+    struct NativeArg {
+        static T get(void* arg) { return *static_cast<T*>(arg); }
+    };
+
+    template <typename T>
+    struct NativeArg<T*> {
+        static T* get(void* arg) { return static_cast<T*>(arg); }
+    };
+
+    /*! \brief Calls kernel with arguments unpacked from KernelLaunch::ptrs
+     The argument types come from the kernel signature, so there is no lookup or conversion at run time, besides the one indirect call.
+     */
+    template <typename F, F kernel>
+    struct NativeInvoker;
+
+    template <typename... ARGS, void (*kernel)(ARGS...)>
+    struct NativeInvoker<void (*)(ARGS...), kernel> {
+        static const int NUM_ARGS = sizeof...(ARGS);
+        /// See NativeKernelInfo. One more than the arguments, so kernels without any have them too
+        static const size_t ARG_SIZES[sizeof...(ARGS) + 1];
+        static const bool ARG_IS_POINTER[sizeof...(ARGS) + 1];
+
+        static void invoke(void* const* args) {
+            call(args, typename MakeNativeArgIndices<sizeof...(ARGS)>::Type());
+        }
+    private:
+        template <size_t... I>
+        static void call(void* const* args, NativeArgIndices<I...>) {
+            (void)args;
+            kernel(NativeArg<ARGS>::get(args[I])...);
+        }
+    };
+
+    template <typename... ARGS, void (*kernel)(ARGS...)>
+    const size_t NativeInvoker<void (*)(ARGS...), kernel>::ARG_SIZES[sizeof...(ARGS) + 1] = { sizeof(ARGS)..., 0 };
+
+    template <typename... ARGS, void (*kernel)(ARGS...)>
+    const bool NativeInvoker<void (*)(ARGS...), kernel>::ARG_IS_POINTER[sizeof...(ARGS) + 1] = { std::is_pointer<ARGS>::value..., false };
+
+    /// Waits until all the work items of the current work-group reach the barrier. This is what MEMORY_BARRIER calls in native kernels
+    void nativeBarrier();
+
 #endif
 }
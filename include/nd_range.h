@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+
+#if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /*! \brief Size of a launch or of its work-groups in 1, 2 or 3 dimensions, like the OpenCL NDRange. The dimensions it does not have are 1.
+     The empty NDRange() as a local size means, that the launch picks it (see chooseLocalSize)
+     */
+    struct NDRange {
+        enum { MAX_DIMS = 3 };
+
+        NDRange():dims(0) {
+            sizes[0] = sizes[1] = sizes[2] = 1;
+        }
+
+        NDRange(size_t x):dims(1) {
+            sizes[0] = x;
+            sizes[1] = sizes[2] = 1;
+        }
+
+        NDRange(size_t x, size_t y):dims(2) {
+            sizes[0] = x;
+            sizes[1] = y;
+            sizes[2] = 1;
+        }
+
+        NDRange(size_t x, size_t y, size_t z):dims(3) {
+            sizes[0] = x;
+            sizes[1] = y;
+            sizes[2] = z;
+        }
+
+        size_t operator[](int dim) const {
+            return sizes[dim];
+        }
+
+        size_t& operator[](int dim) {
+            return sizes[dim];
+        }
+
+        /// \return Number of dimensions, 0 for the empty NDRange
+        int getDims() const {
+            return dims;
+        }
+
+        bool isEmpty() const {
+            return dims == 0;
+        }
+
+        /// \return Number of work items in all the dimensions together
+        size_t getTotal() const {
+            return isEmpty() ? 0 : sizes[0] * sizes[1] * sizes[2];
+        }
+
+        /// \return The sizes rounded up to multiples of local, so the launch has only whole work-groups
+        NDRange roundUp(const NDRange& local) const {
+            NDRange result = *this;
+            for (int i = 0; i < MAX_DIMS; ++i)
+                result.sizes[i] = (sizes[i] + local.sizes[i] - 1) / local.sizes[i] * local.sizes[i];
+            return result;
+        }
+    private:
+        int dims;
+        size_t sizes[MAX_DIMS];
+    };
+
+    /*! \brief Picks the work-group size of a launch of global work items.
+     The group size is the largest power of 2 up to targetSize and maxSize. The first dimension gets preferredMultiple items first (a warp or wavefront reads neighbouring memory in one go), then the smallest dimension is doubled, so 2D and 3D groups are close to square tiles. No dimension is made bigger than its global size needs
+     \param targetSize Group size, that runs best (e.g. the one with the most occupancy)
+     \param maxSize Largest group size, that the kernel can be launched with
+     \param preferredMultiple Warp or wavefront size, 1 if there is none
+     */
+    inline NDRange chooseLocalSize(const NDRange& global, size_t targetSize, size_t maxSize, size_t preferredMultiple) {
+        //OpenCL devices and CUDA allow at most 64 items in the third dimension
+        const size_t MAX_Z = 64;
+        const int dims = std::max(1, global.getDims());
+        NDRange local = dims == 1 ? NDRange(1) : dims == 2 ? NDRange(1, 1) : NDRange(1, 1, 1);
+        size_t limit = 1;
+        while (limit * 2 <= std::min(targetSize, maxSize))
+            limit *= 2;
+        size_t fit[NDRange::MAX_DIMS];
+        for (int i = 0; i < NDRange::MAX_DIMS; ++i) {
+            fit[i] = 1;
+            while (i < dims && fit[i] < global[i])
+                fit[i] *= 2;
+        }
+        fit[2] = std::min(fit[2], MAX_Z);
+
+        size_t total = 1;
+        while (total * 2 <= limit && local[0] * 2 <= std::min(fit[0], std::max<size_t>(preferredMultiple, 1))) {
+            local[0] *= 2;
+            total *= 2;
+        }
+        while (total * 2 <= limit) {
+            int smallest = -1;
+            for (int i = 0; i < dims; ++i)
+                if (local[i] * 2 <= fit[i] && (smallest < 0 || local[i] < local[smallest]))
+                    smallest = i;
+            if (smallest < 0)
+                break;
+            local[smallest] *= 2;
+            total *= 2;
+        }
+        return local;
+    }
+}
@@ -136,55 +136,182 @@ namespace GPAPI {
         }
     }
     
+    /// Creates the context of one device. The task of parallelFor in getOCLContexts
     template <typename C, typename D, typename P>
-    void getOCLContexts(C& contexts, const D& devices, const P& platforms) {
-        GPU_RESULT err = GPU_SUCCESS;
-        contexts.reserve(devices.size());
-        for (int i = 0; i < devices.size(); ++i) {
+    struct OCLContextTask {
+        OCLContextTask(C& contextIds, const D& deviceIds, const P& platformIds):contexts(contextIds), devices(deviceIds), platforms(platformIds) {
+        }
+        
+        void operator()(int i) {
+            GPU_RESULT err = GPU_SUCCESS;
             cl_context_properties contextProperties[] =
             {
                 CL_CONTEXT_PLATFORM,
                 (cl_context_properties)platforms[0],
                 0
             };
-            contexts.push_back(clCreateContext(contextProperties, 1, &devices[i], NULL, NULL, &err));
+            contexts[i] = clCreateContext(contextProperties, 1, &devices[i], NULL, NULL, &err);
             CHECK_ERROR(err);
         }
+        
+        C& contexts;
+        const D& devices;
+        const P& platforms;
+    };
+    
+    /// Creates a context for each device, concurrently
+    template <typename C, typename D, typename P>
+    void getOCLContexts(C& contexts, const D& devices, const P& platforms) {
+        contexts.resize(devices.size());
+        OCLContextTask<C, D, P> task(contexts, devices, platforms);
+        parallelFor((int)devices.size(), task);
     }
     
-    template<typename P, typename C>
-    void getOCLPrograms(P& programs, const C& contexts, const char* source) {
-        size_t lengths[1] = {strlen(source)};
-        const char* sources[1] = {source};
-        GPU_RESULT err = GPU_SUCCESS;
-        for (int i = 0; i < contexts.size(); ++i) {
-            programs.push_back(clCreateProgramWithSource(contexts[i],
-                                                         1,
-                                                         sources,
-                                                         lengths,
-                                                         &err));
-            CHECK_ERROR(err);
+    /// \return The string info of device, e.g. CL_DEVICE_NAME or CL_DRIVER_VERSION
+    inline std::string getOCLDeviceInfo(cl_device_id device, cl_device_info info) {
+        char buffer[1024];
+        GPU_RESULT err = clGetDeviceInfo(device, info, sizeof(buffer), buffer, NULL);
+        CHECK_ERROR(err);
+        return buffer;
+    }
+    
+    /// Builds program for device. Exits with the build log if it fails
+    inline void buildOCLProgram(cl_program program, cl_device_id device, const char* options) {
+        GPU_RESULT err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+        if (err != GPU_SUCCESS) {
+            char buildLog[2048];
+            if (clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(buildLog), buildLog, NULL) == GPU_SUCCESS)
+                printLog(LogTypeError, "*** %s", buildLog);
         }
+        CHECK_ERROR(err);
+    }
+    
+    /// \return The program binary, that the driver built for the only device of program
+    inline std::vector<char> getOCLProgramBinary(cl_program program) {
+        size_t size = 0;
+        GPU_RESULT err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL);
+        std::vector<char> binary(size);
+        if (err == GPU_SUCCESS && size) {
+            unsigned char* binaries[1] = { (unsigned char*)&binary[0] };
+            err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL);
+        }
+        if (err != GPU_SUCCESS)
+            binary.clear();
+        return binary;
+    }
+    
+    /// \return The driver of device, that its programs are built with
+    inline std::string getOCLDriverVersion(cl_device_id device) {
+        return getOCLDeviceInfo(device, CL_DRIVER_VERSION) + " " + getOCLDeviceInfo(device, CL_DEVICE_VERSION);
+    }
+    
+    /// \return The program of binary, built for device, or NULL if the driver rejects the binary
+    inline cl_program createOCLProgramWithBinary(cl_context context, cl_device_id device, const std::vector<char>& binary, const char* options) {
+        GPU_RESULT err = GPU_SUCCESS;
+        const size_t size = binary.size();
+        const unsigned char* binaries[1] = { (const unsigned char*)&binary[0] };
+        cl_int binaryStatus = GPU_SUCCESS;
+        cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &binaryStatus, &err);
+        if (err == GPU_SUCCESS && binaryStatus == GPU_SUCCESS)
+            err = clBuildProgram(program, 1, &device, options, NULL, NULL); //only links a binary, it does not compile it again
+        if (err == GPU_SUCCESS && binaryStatus == GPU_SUCCESS)
+            return program;
+        if (program)
+            clReleaseProgram(program);
+        return NULL;
     }
     
-    template<typename P, typename D>
-    void buildOCLPrograms(const P& programs, const D& devices) {
+    /*! \brief Creates and builds the program of device.
+     If cache has a binary for the source, the options and the device model and driver, the program is created from it (clCreateProgramWithBinary) and the compilation is skipped. Otherwise it is built from source and its binary is cached for the next run
+     \param label Names the program in the log
+     */
+    inline cl_program getOCLProgram(cl_context context, cl_device_id device, const std::string& source, const char* options, ProgramCache& cache, const std::string& label) {
         GPU_RESULT err = GPU_SUCCESS;
+        cl_program program = NULL;
+        std::string key;
+        if (cache.isEnabled())
+            key = ProgramCache::makeKey(source, options, getOCLDeviceInfo(device, CL_DEVICE_NAME), getOCLDriverVersion(device));
+        std::vector<char> binary;
+        if (cache.load(key, binary)) {
+            program = createOCLProgramWithBinary(context, device, binary, options);
+            if (program) {
+                printLog(LogTypeInfo, "%s loaded from the cache\n", label.c_str());
+                return program;
+            }
+            //the driver rejects the binary (e.g. it was updated without changing its version), so the entry is dropped
+            printLog(LogTypeWarning, "cached %s is rejected, compiling it again\n", label.c_str());
+            cache.erase(key);
+        }
+        
+        const char* sources[1] = { source.c_str() };
+        const size_t lengths[1] = { source.size() };
+        program = clCreateProgramWithSource(context, 1, sources, lengths, &err);
+        CHECK_ERROR(err);
+        buildOCLProgram(program, device, options);
+        printLog(LogTypeInfo, "%s compiled successfully\n", label.c_str());
+        if (cache.isEnabled())
+            cache.store(key, getOCLProgramBinary(program));
+        return program;
+    }
+    
+    /// Builds the programs of one group of identical devices. The task of parallelFor in getOCLPrograms
+    template<typename P, typename C, typename D>
+    struct OCLProgramTask {
+        OCLProgramTask(P& programIds, const C& contextIds, const D& deviceIds, const std::vector<std::vector<int> >& deviceGroups, const std::string& programSource, ProgramCache& programCache)
+            :programs(programIds), contexts(contextIds), devices(deviceIds), groups(deviceGroups), source(programSource), cache(programCache) {
+        }
+        
+        void operator()(int group) {
+            const char* options = "";
+            const std::vector<int>& indexes = groups[group];
+            const int first = indexes[0];
+            programs[first] = getOCLProgram(contexts[first], devices[first], source, options, cache, getLabel(first));
+            if (indexes.size() == 1)
+                return;
+            const std::vector<char> binary = getOCLProgramBinary(programs[first]);
+            for (size_t j = 1; j < indexes.size(); ++j) {
+                const int i = indexes[j];
+                programs[i] = binary.empty() ? NULL : createOCLProgramWithBinary(contexts[i], devices[i], binary, options);
+                if (programs[i])
+                    printLog(LogTypeInfo, "program %i shared with identical device %i\n", i, first);
+                else
+                    programs[i] = getOCLProgram(contexts[i], devices[i], source, options, cache, getLabel(i));
+            }
+        }
         
+        static std::string getLabel(int index) {
+            char label[32];
+            snprintf(label, sizeof(label), "program %i", index);
+            return label;
+        }
+        
+        P& programs;
+        const C& contexts;
+        const D& devices;
+        const std::vector<std::vector<int> >& groups;
+        const std::string& source;
+        ProgramCache& cache;
+    };
+    
+    /*! \brief Builds the program of each device.
+     Devices of the same model and driver are grouped: the program is compiled (or loaded from cache) once for each group, and the other devices of the group get its binary. The groups are built concurrently
+     */
+    template<typename P, typename C, typename D>
+    void getOCLPrograms(P& programs, const C& contexts, const D& devices, const std::string& source, ProgramCache& cache) {
+        std::map<std::string, int> groupOfModel;
+        std::vector<std::vector<int> > groups;
         for (int i = 0; i < devices.size(); ++i) {
-            err = clBuildProgram (programs[i],1,&devices[i],NULL,NULL,NULL);
-            if (err != GPU_SUCCESS) {
-                
-                size_t buildLogSize;
-                char buildLog[2048];
-                err = clGetProgramBuildInfo (programs[i],devices[i],CL_PROGRAM_BUILD_LOG,2048,buildLog,&buildLogSize);
-                CHECK_ERROR(err);
-                printLog(LogTypeError, "*** %s", buildLog);
-                
+            const std::string model = getOCLDeviceInfo(devices[i], CL_DEVICE_NAME) + "\n" + getOCLDriverVersion(devices[i]);
+            std::map<std::string, int>::iterator it = groupOfModel.find(model);
+            if (it == groupOfModel.end()) {
+                it = groupOfModel.insert(std::make_pair(model, (int)groups.size())).first;
+                groups.push_back(std::vector<int>());
             }
-            CHECK_ERROR(err);
-            printLog(LogTypeInfo, "program %i compiled successfully\n", i);
+            groups[it->second].push_back(i);
         }
+        programs.resize(devices.size());
+        OCLProgramTask<P, C, D> task(programs, contexts, devices, groups, source, cache);
+        parallelFor((int)groups.size(), task);
     }
     
     template <typename T, typename C>
@@ -199,6 +326,7 @@ namespace GPAPI {
     template <typename PLATFORMS, typename DEVICES, typename NAMES, typename CONTEXTS, typename PROGRAMS, typename LOCAL_MEM, typename THREADS_PER_BLOCK>
     void initOpenCL(PLATFORMS& platformIds, DEVICES& deviceIds, NAMES& deviceNames, CONTEXTS& contextIds, PROGRAMS& programIds, const::std::string& source, LOCAL_MEM& localMem, THREADS_PER_BLOCK& threadsPerBlock, InitParams initParams)
     {
+        InitTimer timer;
         getOCLPlatforms(platformIds);
         getOCLDevices(deviceIds, deviceNames, platformIds, localMem, threadsPerBlock);
         
@@ -219,9 +347,18 @@ namespace GPAPI {
             threadsPerBlock.erase(threadsPerBlock.begin() + i);
         }
         
+        timer.phase("query devices");
+        
         getOCLContexts(contextIds, deviceIds, platformIds);
-        getOCLPrograms(programIds, contextIds, source.c_str());
-        buildOCLPrograms(programIds, deviceIds);
+        timer.phase("create contexts");
+        if (initParams.compileMode != InitParams::CompileAtInit) {
+            //each device builds its program when it is first used
+            programIds.resize(deviceIds.size());
+            return;
+        }
+        ProgramCache cache(initParams.programCacheDir, initParams.programCacheMaxBytes);
+        getOCLPrograms(programIds, contextIds, deviceIds, source, cache);
+        timer.phase("build programs");
     }
 #endif //TARGET_OPENCL
 }
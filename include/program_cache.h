@@ -0,0 +1,187 @@
+#pragma once
+
+#include "common.h"
+
+#ifndef __GPAPI_H__
+#   error For GPAPI you need only to include gpapi.h
+#endif
+
+namespace GPAPI {
+    /*! \brief On-disk cache of compiled programs (OpenCL binaries, CUDA PTX and cubin), so a new process does not compile the same source again.
+     Each entry is a file named after the hash of its key. The key should hold everything the result depends on: source, options, device name and driver version (see makeKey).
+     A file starts with a header with the key hash, the size and a checksum of the data. Entries, that do not match it (truncated or corrupted), are deleted and built again.
+     Files are written to a temporary name and renamed, so processes that share the directory never read a half-written entry. When the files grow over the size cap, the least recently used are deleted.
+     */
+    struct ProgramCache {
+        /// Default size cap of the cache directory
+        static const size_t DEFAULT_MAX_BYTES = size_t(64) * 1024 * 1024;
+
+        /*! \param directory Where the entries are kept. It is created if missing. If empty, the cache is disabled: load always misses and store does nothing
+         \param maxTotalBytes Size cap of all entries together
+         */
+        ProgramCache(const std::string& directory = std::string(), size_t maxTotalBytes = DEFAULT_MAX_BYTES):dir(directory), maxBytes(maxTotalBytes) {
+            if (!dir.empty())
+                makeDirectory(dir);
+        }
+
+        bool isEnabled() const {
+            return !dir.empty();
+        }
+
+        /// \return Key of a compiled program. Parts are separated, so different splits of the same text give different keys
+        static std::string makeKey(const std::string& source, const std::string& options, const std::string& deviceName, const std::string& driverVersion) {
+            const std::string parts[4] = { source, options, deviceName, driverVersion };
+            std::string key;
+            for (int i = 0; i < 4; ++i) {
+                char length[32];
+                snprintf(length, sizeof(length), "%u:", (unsigned)parts[i].size());
+                key += length;
+                key += parts[i];
+            }
+            return key;
+        }
+
+        /// \return true and the cached data in binary, if there is a valid entry for key
+        bool load(const std::string& key, std::vector<char>& binary) {
+            if (!isEnabled())
+                return false;
+            const std::string path = getPath(key);
+            FILE* file = fopen(path.c_str(), "rb");
+            if (!file)
+                return false;
+            Header header;
+            bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                         !memcmp(header.magic, getMagic(), sizeof(header.magic)) &&
+                         header.keyHash == hash(key.data(), key.size());
+            if (valid) {
+                //the size is checked against the file before it is trusted, a corrupted one could ask for any amount of memory
+                const long dataStart = ftell(file);
+                valid = dataStart >= 0 && !fseek(file, 0, SEEK_END);
+                const long fileEnd = valid ? ftell(file) : -1;
+                valid = valid && fileEnd >= dataStart && header.size == (unsigned long long)(fileEnd - dataStart) && !fseek(file, dataStart, SEEK_SET);
+            }
+            if (valid) {
+                binary.resize((size_t)header.size);
+                valid = header.size == 0 || fread(&binary[0], header.size, 1, file) == 1;
+                valid = valid && fgetc(file) == EOF && header.checksum == hash(binary.empty() ? NULL : &binary[0], binary.size());
+            }
+            fclose(file);
+            if (!valid) {
+                printLog(LogTypeWarning, "program cache entry %s is corrupted, building it again\n", path.c_str());
+                remove(path.c_str());
+                binary.clear();
+                return false;
+            }
+            touchFile(path); //marks the entry as recently used for the size cap
+            return true;
+        }
+
+        /// Keeps binary as the entry of key. Failures are only logged, the cache is an optimization
+        void store(const std::string& key, const std::vector<char>& binary) {
+            if (!isEnabled() || binary.empty())
+                return;
+            Header header;
+            memcpy(header.magic, getMagic(), sizeof(header.magic));
+            header.keyHash = hash(key.data(), key.size());
+            header.size = binary.size();
+            header.checksum = hash(&binary[0], binary.size());
+
+            const std::string path = getPath(key);
+            //identical devices may store the same key at once from the compile threads of one process, so each call gets its own file
+            const std::string tmpPath = path + getTempSuffix();
+            FILE* file = fopen(tmpPath.c_str(), "wb");
+            bool written = file &&
+                           fwrite(&header, sizeof(header), 1, file) == 1 &&
+                           fwrite(&binary[0], binary.size(), 1, file) == 1;
+            if (file && fclose(file))
+                written = false;
+            if (!written || rename(tmpPath.c_str(), path.c_str())) {
+                printLog(LogTypeWarning, "could not write program cache entry %s\n", path.c_str());
+                remove(tmpPath.c_str());
+                return;
+            }
+            trim(path);
+        }
+
+        /*! \brief Loads the entry of key, or calls build(binary) and stores its result if there is none
+         \param build Functor, that compiles the program and fills its vector<char>& argument with the result. Not called on a hit
+         \return true if the entry was in the cache
+         */
+        template <typename BUILD>
+        bool get(const std::string& key, std::vector<char>& binary, BUILD& build) {
+            if (load(key, binary))
+                return true;
+            binary.clear();
+            build(binary);
+            store(key, binary);
+            return false;
+        }
+
+        /// Deletes the entry of key, e.g. if the driver rejects a binary
+        void erase(const std::string& key) {
+            if (isEnabled())
+                remove(getPath(key).c_str());
+        }
+
+        /// Deletes the least recently used entries, until all of them take at most the size cap. The entry at keepPath is never deleted (mtime has only seconds precision, so it may tie with older ones)
+        void trim(const std::string& keepPath = std::string()) {
+            const std::vector<std::string> names = listDirectory(dir);
+            std::vector<std::pair<time_t, std::pair<std::string, size_t> > > entries;
+            size_t total = 0;
+            for (size_t n = 0; n < names.size(); ++n) {
+                const std::string& name = names[n];
+                const size_t extensionSize = strlen(getExtension());
+                if (name.size() <= extensionSize || name.compare(name.size() - extensionSize, extensionSize, getExtension()))
+                    continue;
+                const std::string path = dir + "/" + name;
+                struct stat info;
+                if (path == keepPath || stat(path.c_str(), &info))
+                    continue;
+                entries.push_back(std::make_pair(info.st_mtime, std::make_pair(path, (size_t)info.st_size)));
+                total += info.st_size;
+            }
+            struct stat kept;
+            if (!keepPath.empty() && !stat(keepPath.c_str(), &kept))
+                total += kept.st_size;
+            std::sort(entries.begin(), entries.end());
+            for (size_t i = 0; i < entries.size() && total > maxBytes; ++i) {
+                remove(entries[i].second.first.c_str());
+                total -= entries[i].second.second;
+            }
+        }
+
+        /// FNV-1a hash of bytes
+        static unsigned long long hash(const void* data, size_t bytes) {
+            unsigned long long result = 14695981039346656037ULL;
+            for (size_t i = 0; i < bytes; ++i) {
+                result ^= ((const unsigned char*)data)[i];
+                result *= 1099511628211ULL;
+            }
+            return result;
+        }
+    private:
+        struct Header {
+            char magic[8];
+            unsigned long long keyHash;
+            unsigned long long size;
+            unsigned long long checksum;
+        };
+        /// Start of each entry, 8 bytes with the terminating zero. Changed when the layout changes
+        static const char* getMagic() {
+            return "GPAPI01";
+        }
+
+        static const char* getExtension() {
+            return ".gpapibin";
+        }
+
+        std::string getPath(const std::string& key) const {
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx", hash(key.data(), key.size()));
+            return dir + "/" + name + getExtension();
+        }
+
+        std::string dir;
+        size_t maxBytes;
+    };
+}
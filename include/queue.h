@@ -1,53 +1,94 @@
 #pragma once
 
 #include "common.h"
+#include "native_misc.h"
 
 #if !(defined __GPAPI_H__) && !(defined __GPAPI_NATIVE_MISC_H__)
 #   error For GPAPI you need only to include gpapi.h
 #endif
 
 namespace GPAPI {
+    /*! \brief In-order queue of device work (OpenCL command queue, CUDA stream or native queue).
+     The work on one queue runs in the order it was enqueued. Work on different queues of the same device may run concurrently.
+     */
     struct Queue {
     private:
         GPU_QUEUE queue;
+        GPU_CONTEXT context;
     public:
         Queue() { queue = NULL; };
-        
-        void init(GPU_DEVICE device, GPU_CONTEXT context) {
+
+        /// \param index Position of the queue in its device. On the native target it is the lane (first worker) of the queue
+        void init(GPU_DEVICE device, GPU_CONTEXT contextId, int index) {
             freeMem();
-            
+            context = contextId;
+
             GPU_RESULT err = GPU_SUCCESS;
 #ifdef TARGET_OPENCL
-            cl_command_queue_properties queueFlags;
-            err = clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(queueFlags), &queueFlags, NULL);
-            CHECK_ERROR(err);
-            
-            queueFlags &= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
-            
             queue = clCreateCommandQueue(context, device, 0, &err);
+#endif
+#ifdef TARGET_CUDA
+            //not CU_STREAM_NON_BLOCKING, so the synchronous copies still wait for the work on all the queues
+            pushContext(context);
+            err = cuStreamCreate(&queue, CU_STREAM_DEFAULT);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            queue = new NativeQueue(index);
 #endif
             CHECK_ERROR(err);
 
         }
+
+        /// Blocks until all the work on the queue is done
+        void wait() {
+            if (!queue)
+                return;
+            GPU_RESULT err = GPU_SUCCESS;
+#ifdef TARGET_OPENCL
+            err = clFinish(queue);
+#endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = cuStreamSynchronize(queue);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            queue->wait();
+#endif
+            CHECK_ERROR(err);
+        }
+
+        /// Releases the queue. The work on it should be done. May be called multiple times
         void freeMem() {
+            if (!queue)
+                return;
+            GPU_RESULT err = GPU_SUCCESS;
 #ifdef TARGET_OPENCL
-           
+            err = clReleaseCommandQueue(queue);
 #endif
+#ifdef TARGET_CUDA
+            pushContext(context);
+            err = cuStreamDestroy(queue);
+            popContext(context);
+#endif
+#ifdef TARGET_NATIVE
+            delete queue;
+#endif
+            queue = NULL;
+            CHECK_ERROR(err);
         }
-        
+
         GPU_QUEUE get() const {
             return queue;
         }
-        
+
         ~Queue() {
-#ifdef TARGET_OPENCL
-             clReleaseCommandQueue(queue);
-             queue = NULL;
-#endif
+            freeMem();
         }
-        
+
     private:
         Queue(const Queue&);
         Queue& operator=(const Queue&);
     };
-}
\ No newline at end of file
+}
@@ -3,11 +3,16 @@
  Only part of the common features of cpp, cuda and opencl is exposed.
  * Functions that can be called from the host are marked with KERNEL
  * Functions that can be called from the device are marked with DEVICE
- * Shared memory is marked with SHARED
+ * Shared memory is marked with SHARED. Shared variables are declared in the kernel body, without initializer
  * Restrict (aka no pointer-alias) memory is marked with RESTRICT
  * Memory barrier (syncthreads, barrier) is marked with MEMORY_BARRIER;
  * Memory, that is allocated in the global memory is marked with GLOBAL
  * The only valid way to get unique thread id is with the globalID() function.
+ * The position inside the work-group and the launch sizes are available with localID(), groupID(), globalSize(), localSize() and numGroups().
+ * 2D and 3D launches (Device::launchKernel with NDRange) get the same values in each dimension with globalIDDim(dim), localIDDim(dim), groupIDDim(dim), globalSizeDim(dim), localSizeDim(dim) and numGroupsDim(dim). The functions without Dim are the ones of dimension 0.
+ * Each kernel is followed by REGISTER_KERNEL(name), so the native target can find it by name.
+ * Kernels without barriers can wrap their body in FOR_EACH_ITEM(id), so the native target runs many work items in one vectorizable loop.
+ * Compile-time constants of a kernel can be set per variant (Device::setKernel with KernelDefines). On the native target such a kernel is a KERNEL_TEMPLATE and each variant is registered with REGISTER_KERNEL_VARIANT.
  * Only C types and float4 type are available by default.
  */
 
@@ -23,6 +28,9 @@
     #define FLOAT4 float4
     #define RESTRICT restrict
     #define MEMORY_BARRIER barrier(CLK_LOCAL_MEM_FENCE)
+    #define REGISTER_KERNEL(name)
+    #define REGISTER_KERNEL_VARIANT(name, defines, ...)
+    #define KERNEL_TEMPLATE(...)
 #endif
 
 #ifdef __CUDACC__  
@@ -32,7 +40,10 @@
     #define SHARED __shared__
     #define FLOAT4 make_float4
     #define RESTRICT __restrict__
-    #define MEMORY_BARRIER __syncthreads
+    #define MEMORY_BARRIER __syncthreads()
+    #define REGISTER_KERNEL(name)
+    #define REGISTER_KERNEL_VARIANT(name, defines, ...)
+    #define KERNEL_TEMPLATE(...)
 #endif
 
 #if (!defined __OPENCL_VERSION__) && (!defined __CUDACC__)
@@ -43,10 +54,41 @@
     #define KERNEL inline
     #define GLOBAL
     #define DEVICE inline
-    #define SHARED
     #define FLOAT4 float4
-    #define RESTRICT
+#ifdef _MSC_VER
+    #define RESTRICT __restrict
+#else
+    #define RESTRICT __restrict__
+#endif
+#ifdef __NATIVE__
+    #define SHARED static thread_local
+    #define MEMORY_BARRIER GPAPI::nativeBarrier()
+    #define REGISTER_KERNEL(name) \
+        static GPAPI::NativeKernelRegistrar name##Registrar(#name, \
+            &GPAPI::NativeInvoker<decltype(&name), &name>::invoke, \
+            GPAPI::NativeInvoker<decltype(&name), &name>::NUM_ARGS, \
+            GPAPI::NativeInvoker<decltype(&name), &name>::ARG_SIZES, \
+            GPAPI::NativeInvoker<decltype(&name), &name>::ARG_IS_POINTER);
+    /* Registers the template instance (the last argument) as the variant of name with the defines key (see getDefinesKey), e.g. REGISTER_KERNEL_VARIANT(tileSum, "TILE=16", tileSum<16>) */
+    #define REGISTER_KERNEL_VARIANT(name, defines, ...) \
+        REGISTER_KERNEL_VARIANT_AT(__LINE__, name, defines, __VA_ARGS__)
+    #define REGISTER_KERNEL_VARIANT_AT(line, name, defines, ...) \
+        REGISTER_KERNEL_VARIANT_LINE(line, name, defines, __VA_ARGS__)
+    #define REGISTER_KERNEL_VARIANT_LINE(line, name, defines, ...) \
+        static GPAPI::NativeKernelRegistrar name##Registrar##line(#name, \
+            &GPAPI::NativeInvoker<decltype(&__VA_ARGS__), &__VA_ARGS__>::invoke, \
+            GPAPI::NativeInvoker<decltype(&__VA_ARGS__), &__VA_ARGS__>::NUM_ARGS, \
+            GPAPI::NativeInvoker<decltype(&__VA_ARGS__), &__VA_ARGS__>::ARG_SIZES, \
+            GPAPI::NativeInvoker<decltype(&__VA_ARGS__), &__VA_ARGS__>::ARG_IS_POINTER, defines);
+    /* The constants of a kernel with variants are template parameters on the native target and defines elsewhere */
+    #define KERNEL_TEMPLATE(...) template <__VA_ARGS__>
+#else
+    #define SHARED
     #define MEMORY_BARRIER
+    #define REGISTER_KERNEL(name)
+    #define REGISTER_KERNEL_VARIANT(name, defines, ...)
+    #define KERNEL_TEMPLATE(...)
+#endif
 #endif
 
 #if !defined(__CUDACC__) && !defined(__OPENCL_VERSION__)
@@ -80,6 +122,17 @@ DEVICE float4& operator/=(float4& a, const float& b) { a.x/=b; a.y/=b; a.z/=b; a
 #endif
 
 
+#ifdef __NATIVE__
+/*! \return Position in dimension dim of the item linear, in a grid of counts items, with the first dimension fastest */
+DEVICE int nativeDecode(size_t linear, const size_t* counts, int dim) {
+    if (dim == 0)
+        return (int)(linear % counts[0]);
+    if (dim == 1)
+        return (int)(linear / counts[0] % counts[1]);
+    return (int)(linear / (counts[0] * counts[1]));
+}
+#endif
+
 /*! \return Unique global thread id */
 DEVICE int globalID() {
 #ifdef __OPENCL_VERSION__
@@ -89,11 +142,190 @@ DEVICE int globalID() {
     return blockIdx.x*blockDim.x + threadIdx.x;
 #endif //__CUDACC__
 #ifdef __NATIVE__
-    extern int threadIdx;
-    return threadIdx;
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    const GPAPI::NativeWorkItem& item = nativeWorkItem;
+    if (item.dims > 1)
+        return nativeDecode(item.groupID, item.groupCounts, 0) * (int)item.localSizes[0] + nativeDecode(item.localID, item.localSizes, 0);
+    return (int)item.globalID;
 #endif
 }
 
+/*! \return Id of the thread inside its work-group (block) */
+DEVICE int localID() {
+#ifdef __OPENCL_VERSION__
+    return get_local_id(0);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return threadIdx.x;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    const GPAPI::NativeWorkItem& item = nativeWorkItem;
+    return item.dims > 1 ? nativeDecode(item.localID, item.localSizes, 0) : (int)item.localID;
+#endif
+}
+
+/*! \return Id of the work-group (block) of the thread */
+DEVICE int groupID() {
+#ifdef __OPENCL_VERSION__
+    return get_group_id(0);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return blockIdx.x;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    const GPAPI::NativeWorkItem& item = nativeWorkItem;
+    return item.dims > 1 ? nativeDecode(item.groupID, item.groupCounts, 0) : (int)item.groupID;
+#endif
+}
+
+/*! \return Total number of threads in the launch */
+DEVICE int globalSize() {
+#ifdef __OPENCL_VERSION__
+    return get_global_size(0);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return gridDim.x*blockDim.x;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.globalSizes[0];
+#endif
+}
+
+/*! \return Number of threads in each work-group (block) */
+DEVICE int localSize() {
+#ifdef __OPENCL_VERSION__
+    return get_local_size(0);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return blockDim.x;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.localSizes[0];
+#endif
+}
+
+/*! \return Number of work-groups (blocks) in the launch */
+DEVICE int numGroups() {
+#ifdef __OPENCL_VERSION__
+    return get_num_groups(0);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return gridDim.x;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.groupCounts[0];
+#endif
+}
+
+/*! \return Id of the thread inside its work-group in dimension dim (0, 1 or 2) */
+DEVICE int localIDDim(int dim) {
+#ifdef __OPENCL_VERSION__
+    return get_local_id(dim);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return dim == 0 ? threadIdx.x : dim == 1 ? threadIdx.y : threadIdx.z;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return nativeDecode(nativeWorkItem.localID, nativeWorkItem.localSizes, dim);
+#endif
+}
+
+/*! \return Id of the work-group of the thread in dimension dim */
+DEVICE int groupIDDim(int dim) {
+#ifdef __OPENCL_VERSION__
+    return get_group_id(dim);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return dim == 0 ? blockIdx.x : dim == 1 ? blockIdx.y : blockIdx.z;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return nativeDecode(nativeWorkItem.groupID, nativeWorkItem.groupCounts, dim);
+#endif
+}
+
+/*! \return Number of threads in each work-group in dimension dim */
+DEVICE int localSizeDim(int dim) {
+#ifdef __OPENCL_VERSION__
+    return get_local_size(dim);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return dim == 0 ? blockDim.x : dim == 1 ? blockDim.y : blockDim.z;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.localSizes[dim];
+#endif
+}
+
+/*! \return Number of work-groups in dimension dim */
+DEVICE int numGroupsDim(int dim) {
+#ifdef __OPENCL_VERSION__
+    return get_num_groups(dim);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return dim == 0 ? gridDim.x : dim == 1 ? gridDim.y : gridDim.z;
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.groupCounts[dim];
+#endif
+}
+
+/*! \return Global id of the thread in dimension dim */
+DEVICE int globalIDDim(int dim) {
+#ifdef __OPENCL_VERSION__
+    return get_global_id(dim);
+#else
+    return groupIDDim(dim) * localSizeDim(dim) + localIDDim(dim);
+#endif
+}
+
+/*! \return Number of threads of the launch in dimension dim */
+DEVICE int globalSizeDim(int dim) {
+#ifdef __OPENCL_VERSION__
+    return get_global_size(dim);
+#endif //__OPENCL_VERSION__
+#ifdef __CUDACC__
+    return numGroupsDim(dim) * localSizeDim(dim);
+#endif //__CUDACC__
+#ifdef __NATIVE__
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.globalSizes[dim];
+#endif
+}
+
+#ifdef __NATIVE__
+/*! \return The first work item of the native FOR_EACH_ITEM loop. Marks that the loop runs all work items up to nativeLoopEnd() */
+DEVICE int nativeLoopBegin() {
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    nativeWorkItem.looped = true;
+    return (int)nativeWorkItem.globalID;
+}
+
+/*! \return One past the last work item of the native FOR_EACH_ITEM loop */
+DEVICE int nativeLoopEnd() {
+    extern thread_local GPAPI::NativeWorkItem nativeWorkItem;
+    return (int)nativeWorkItem.loopEnd;
+}
+#endif
+
+/*! \brief Runs the block that follows for the work items of the kernel, with id set to globalID().
+ On OpenCL and CUDA the block runs once. On the native target the first work item runs the block for a whole chunk of work items, so the compiler can vectorize the loop.
+ The block should not use MEMORY_BARRIER, localID(), groupID() and the functions of 2D and 3D launches (globalIDDim() and the others).
+ */
+#ifdef __NATIVE__
+    #define FOR_EACH_ITEM(id) for (int id = nativeLoopBegin(), id##End = nativeLoopEnd(); id < id##End; ++id)
+#else
+    #define FOR_EACH_ITEM(id) for (int id = globalID(), id##Once = 1; id##Once; id##Once = 0)
+#endif
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Kernel example
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -104,14 +336,162 @@ void vecAdd(GLOBAL int * RESTRICT a,
             GLOBAL int * RESTRICT c,
             unsigned int n)
 {
-    //Get our global thread ID
+    for (int i = 0; i < (int)n; ++i) {
+        //id is our global thread ID
+        FOR_EACH_ITEM(id) {
+            //Make sure we do not go out of bounds
+            if (id < (int)n) {
+                int ai = a[id] + 1;
+                int bi = b[id];
+                c[id] = ai + bi;
+            }
+        }
+    }
+}
+REGISTER_KERNEL(vecAdd)
+
+/*! Sums each work-group of a in shared memory and writes the sum of group i in sums[i]. The work-group size should be a power of two, not bigger than 256 */
+KERNEL
+void groupSum(GLOBAL int * RESTRICT a,
+              GLOBAL int * RESTRICT sums,
+              unsigned int n)
+{
+    SHARED int partial[256];
+    int id = globalID();
+    int lid = localID();
+    partial[lid] = (id < (int)n) ? a[id] : 0;
+    MEMORY_BARRIER;
+    for (int step = localSize() / 2; step > 0; step /= 2) {
+        if (lid < step)
+            partial[lid] += partial[lid + step];
+        MEMORY_BARRIER;
+    }
+    if (lid == 0)
+        sums[groupID()] = partial[0];
+}
+REGISTER_KERNEL(groupSum)
+
+/*! Writes the transpose of the matrix in (height rows of width elements) to out. A 2D launch with one work item for each element of in, e.g. launchKernel(NDRange(width, height)) */
+KERNEL
+void transpose(GLOBAL const float * RESTRICT in,
+               GLOBAL float * RESTRICT out,
+               unsigned int width,
+               unsigned int height)
+{
+    const int x = globalIDDim(0);
+    const int y = globalIDDim(1);
+    if (x < (int)width && y < (int)height)
+        out[x * height + y] = in[y * width + x];
+}
+REGISTER_KERNEL(transpose)
+
+/*! Writes the sum of the i-th run of TILE elements of a in sums[i]. n should be a multiple of TILE.
+ TILE is a compile-time constant, so the loop is unrolled. Set it with Device::setKernel("tileSum", defines), the default is 16 */
+#ifndef __NATIVE__
+#   ifndef TILE
+#       define TILE 16
+#   endif
+#endif
+KERNEL_TEMPLATE(int TILE)
+KERNEL
+void tileSum(GLOBAL int * RESTRICT a,
+             GLOBAL int * RESTRICT sums,
+             unsigned int n)
+{
+    FOR_EACH_ITEM(id) {
+        if (id < (int)(n / TILE)) {
+            int sum = 0;
+            for (int i = 0; i < TILE; ++i)
+                sum += a[id * TILE + i];
+            sums[id] = sum;
+        }
+    }
+}
+REGISTER_KERNEL_VARIANT(tileSum, "", tileSum<16>)
+REGISTER_KERNEL_VARIANT(tileSum, "TILE=4", tileSum<4>)
+REGISTER_KERNEL_VARIANT(tileSum, "TILE=16", tileSum<16>)
+REGISTER_KERNEL_VARIANT(tileSum, "TILE=64", tileSum<64>)
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels of bench/bench_for_each_item.cpp: the same work with FOR_EACH_ITEM and with one call per work item
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*! vecAdd without FOR_EACH_ITEM */
+KERNEL
+void vecAddPerItem(GLOBAL int * RESTRICT a,
+                   GLOBAL int * RESTRICT b,
+                   GLOBAL int * RESTRICT c,
+                   unsigned int n)
+{
     int id = globalID();
-    //Make sure we do not go out of bounds
-    for (int i = 0; i < n; ++i) {
-        if (id < n) {
+    for (int i = 0; i < (int)n; ++i) {
+        if (id < (int)n) {
             int ai = a[id] + 1;
             int bi = b[id];
             c[id] = ai + bi;
         }
     }
-}
\ No newline at end of file
+}
+REGISTER_KERNEL(vecAddPerItem)
+
+/*! \return a and b mixed by t, scaled to the length of a */
+DEVICE float4 blend(float4 a, float4 b, float t) {
+    return normalize(a * t + b * (1.0f - t)) * length(a);
+}
+
+/*! Writes blend(a[i], b[i], t) to out[i] */
+KERNEL
+void blend4(GLOBAL const float4 * RESTRICT a,
+            GLOBAL const float4 * RESTRICT b,
+            GLOBAL float4 * RESTRICT out,
+            float t,
+            unsigned int n)
+{
+    FOR_EACH_ITEM(id) {
+        if (id < (int)n)
+            out[id] = blend(a[id], b[id], t);
+    }
+}
+REGISTER_KERNEL(blend4)
+
+/*! blend4 without FOR_EACH_ITEM */
+KERNEL
+void blend4PerItem(GLOBAL const float4 * RESTRICT a,
+                   GLOBAL const float4 * RESTRICT b,
+                   GLOBAL float4 * RESTRICT out,
+                   float t,
+                   unsigned int n)
+{
+    int id = globalID();
+    if (id < (int)n)
+        out[id] = blend(a[id], b[id], t);
+}
+REGISTER_KERNEL(blend4PerItem)
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels of tests/test_nd_range.cpp
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*! Number of ints, that idProbe writes for each work item */
+#define ID_PROBE_FIELDS 15
+
+/*! Writes the values of the id functions of each work item to out, ID_PROBE_FIELDS ints at the position of the item in the launch (first dimension fastest):
+ globalID, localID, groupID, globalSize, localSize, numGroups, then globalIDDim, localIDDim and groupIDDim of the three dimensions */
+KERNEL
+void idProbe(GLOBAL int * RESTRICT out)
+{
+    const int item = (globalIDDim(2) * globalSizeDim(1) + globalIDDim(1)) * globalSizeDim(0) + globalIDDim(0);
+    GLOBAL int* fields = out + item * ID_PROBE_FIELDS;
+    fields[0] = globalID();
+    fields[1] = localID();
+    fields[2] = groupID();
+    fields[3] = globalSize();
+    fields[4] = localSize();
+    fields[5] = numGroups();
+    for (int dim = 0; dim < 3; ++dim) {
+        fields[6 + dim] = globalIDDim(dim);
+        fields[9 + dim] = localIDDim(dim);
+        fields[12 + dim] = groupIDDim(dim);
+    }
+}
+REGISTER_KERNEL(idProbe)
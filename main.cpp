@@ -36,13 +36,6 @@ int main(int argc, const char *argv[]) {
 	}
 
 	const size_t bytes = NUM_ELEMENTS * sizeof(int);
-	//calculate global and local size
-	size_t globalSize, localSize;
-	// Number of work items in each local work group
-	localSize = 64;
-
-	// Number of total work items - localSize must be devisor
-	globalSize = ceil(NUM_ELEMENTS / (float)localSize) * localSize;
 
 	for (int i = 0; i < devices.size(); ++i) {
 		Device& device = *(devices[i]);
@@ -52,15 +45,16 @@ int main(int argc, const char *argv[]) {
 		//set those args
 		device.addParam(h_a, bytes);
 		device.addParam(h_b, bytes);
-		Buffer *result = device.addParam(NULL, bytes);
+		Buffer &result = device.addParam(NULL, bytes);
 		device.addParam(NUM_ELEMENTS);
 
-		//launch the kernel
-		device.launchKernel(globalSize, localSize);
+		//launch the kernel with one work item for each element. The work-group size is picked for the kernel and the device,
+		//and the global size is rounded up to whole work-groups (the kernel checks the bounds)
+		device.launchKernel(NDRange(NUM_ELEMENTS));
 		//wait for the result
 		device.wait();
 		//copy back the data of the result from the device to the host
-		result->download(device.getQueue(), device.getContext(), h_c, bytes);
+		result.download(device.getQueue(), device.getContext(), h_c, bytes);
 
 		for (int i = 0; i < NUM_ELEMENTS; ++i) {
 			printf("%i ", h_c[i]);
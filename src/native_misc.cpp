@@ -1,3 +1,8 @@
+//the ucontext functions are only declared with _XOPEN_SOURCE on macOS, and it has to come before the first system header
+#if (defined __APPLE__) && !(defined _XOPEN_SOURCE)
+#   define _XOPEN_SOURCE 600
+#   define _DARWIN_C_SOURCE
+#endif
 
 #include "native_misc.h"
 
@@ -5,32 +10,773 @@
 
 #define __NATIVE__
 #include "queue.h"
+#include "event.h"
 #include "buffer.h"
 #include "kernel.h"
 #include "kernel_launch.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
-static int threadIdx;
+//work-group fibers: Windows fibers on Windows, ucontext elsewhere. Define NATIVE_NO_FIBERS where neither exists, then barriers work only in groups of one work item
+#if (defined _WIN32) && !(defined NATIVE_NO_FIBERS)
+#   define NATIVE_WIN32_FIBERS
+#elif !(defined NATIVE_NO_FIBERS)
+#   define NATIVE_UCONTEXT_FIBERS
+#   include <ucontext.h>
+#endif
+
+static thread_local GPAPI::NativeWorkItem nativeWorkItem;
 #include "../kernel.cl"
 
-enum KernelParams {
-    D_A = 0,
-    D_B,
-    D_RES,
-    COUNT,
+namespace {
+    /// Number of chunks each thread gets on average. More chunks balance better, fewer chunks cost less to schedule
+    const size_t CHUNKS_PER_THREAD = 4;
+    /// Largest work-group the native device runs. Once the first work item of a group reaches MEMORY_BARRIER, each of the others gets its own fiber
+    const size_t MAX_GROUP_SIZE = 1024;
+    /// Stack size of each work-item fiber
+    const size_t FIBER_STACK_SIZE = 64 * 1024;
+
+    /// State shared by all the chunks of one launch
+    struct Launch {
+        GPAPI::NativeKernelInfo::Invoke invoke;
+        size_t globalSize;
+        size_t localSize;
+        size_t numGroups;
+        int dims;
+        /// Sizes of each dimension, see NativeWorkItem
+        size_t globalSizes[GPAPI::NDRange::MAX_DIMS];
+        size_t localSizes[GPAPI::NDRange::MAX_DIMS];
+        size_t groupCounts[GPAPI::NDRange::MAX_DIMS];
+        size_t numChunks;
+        size_t chunkSize;
+        /// Worker, that gets the first chunk
+        size_t lane;
+        std::atomic<size_t> pending;
+        std::shared_ptr<GPAPI::NativeEvent> event;
+
+        /// Copy of the kernel arguments, so the KernelLaunch can change them while this launch waits or runs
+        char paramsBuffer[GPAPI::KernelLaunch::PARAMS_BUFFER_SIZE];
+        void* paramsPtrs[GPAPI::KernelLaunch::MAX_PARAMS];
+
+        void setParams(const GPAPI::KernelLaunch& kernelLaunch) {
+            memcpy(paramsBuffer, kernelLaunch.paramsBuffer, kernelLaunch.paramOffset);
+            const char* begin = kernelLaunch.paramsBuffer;
+            for (int i = 0; i < kernelLaunch.numParams; ++i) {
+                const char* param = (const char*)kernelLaunch.paramsPtrs[i];
+                //values point into the params buffer, buffers are device pointers and are kept as they are
+                if (param >= begin && param < begin + GPAPI::KernelLaunch::PARAMS_BUFFER_SIZE)
+                    paramsPtrs[i] = paramsBuffer + (param - begin);
+                else
+                    paramsPtrs[i] = kernelLaunch.paramsPtrs[i];
+            }
+        }
+    };
+
+    /// Work items [begin, end) of one launch. begin is always the first item of a work-group
+    struct Task {
+        Launch* launch;
+        size_t begin;
+        size_t end;
+    };
+
+    void runWorkItem(const Launch& launch) {
+        launch.invoke(launch.paramsPtrs);
+    }
+
+    /// All kernels registered with REGISTER_KERNEL. Filled during static initialization, read-only afterwards
+    std::vector<GPAPI::NativeKernelInfo>& getNativeKernels() {
+        static std::vector<GPAPI::NativeKernelInfo> kernels;
+        return kernels;
+    }
+
+    /*! \brief Runs the work items of one work-group on the current thread.
+     The first work item runs as a plain call. If it finishes without a barrier, so do the others, and kernels without barriers never pay for a context switch.
+     When it reaches its first MEMORY_BARRIER, the other work items start as fibers: each barrier of the first item runs every fiber up to its own next barrier, then lets the first item go on. So no work item passes a barrier before all the others have reached it.
+     */
+    struct WorkGroup {
+        WorkGroup():launch(NULL), begin(0), end(0), loopEnd(0), current(0), fibersStarted(false), fiberRunning(false) {
+#ifdef NATIVE_WIN32_FIBERS
+            scheduler = NULL;
+#endif
+        }
+
+        ~WorkGroup() {
+#ifdef NATIVE_UCONTEXT_FIBERS
+            for (size_t i = 0; i < stacks.size(); ++i)
+                delete[] stacks[i];
+#endif
+#ifdef NATIVE_WIN32_FIBERS
+            for (size_t i = 0; i < fibers.size(); ++i)
+                DeleteFiber(fibers[i]);
+#endif
+        }
+
+        /*! \brief Runs the work items [begin, end) of a work-group
+         \param loopEnd If the first work item runs FOR_EACH_ITEM, it loops over [begin, loopEnd) and the group is not run any further
+         \return true if the first work item ran FOR_EACH_ITEM
+         */
+        bool run(const Launch& launch, size_t begin, size_t end, size_t loopEnd) {
+            this->launch = &launch;
+            this->begin = begin;
+            this->end = end;
+            this->loopEnd = loopEnd;
+            fibersStarted = false;
+
+            GPAPI::NativeWorkItem& item = nativeWorkItem;
+            item.looped = false;
+            setItem(0);
+            runWorkItem(launch);
+            if (item.looped)
+                return true;
+
+            if (!fibersStarted) {
+                for (size_t i = 1; i < end - begin; ++i) {
+                    setItem(i);
+                    runWorkItem(launch);
+                }
+                return false;
+            }
+
+            //the first work item is done, the fibers may still wait at their last barrier
+            while (runRound())
+                ;
+            return false;
+        }
+
+        /// Called by MEMORY_BARRIER from inside a fiber
+        void barrier() {
+            switchToScheduler();
+        }
+
+        /// Called by MEMORY_BARRIER outside of a fiber. Only the barriers of the first work item matter, the others run as plain calls only if it had none
+        void firstItemBarrier() {
+            if (current != 0 || end - begin < 2)
+                return;
+#ifdef NATIVE_NO_FIBERS
+            static std::atomic<bool> reported(false);
+            if (!reported.exchange(true))
+                GPAPI::printLog(GPAPI::LogTypeError, "MEMORY_BARRIER needs fibers, which this build of the native target does not have. Launch kernels with barriers in work-groups of 1 item\n");
+#else
+            if (!fibersStarted) {
+                prepare(end - begin);
+                fibersStarted = true;
+            }
+            runRound();
+            setItem(0);
+#endif
+        }
+
+        bool inFiber() const {
+            return fiberRunning;
+        }
+
+    private:
+        /// Runs each unfinished fiber up to its next barrier or its end. \return true if any of them is not finished yet
+        bool runRound() {
+            bool running = false;
+            for (size_t i = 1; i < end - begin; ++i) {
+                if (finished[i])
+                    continue;
+                resume(i);
+                running = running || !finished[i];
+            }
+            return running;
+        }
+
+        /// Sets the ids of the work item at index as the ones, that the kernel reads
+        void setItem(size_t index) {
+            GPAPI::NativeWorkItem& item = nativeWorkItem;
+            item.globalID = begin + index;
+            item.localID = index;
+            item.loopEnd = index ? begin + index + 1 : loopEnd;
+            current = index;
+        }
+
+        void prepare(size_t size) {
+            started.assign(size, 0);
+            finished.assign(size, 0);
+#ifdef NATIVE_UCONTEXT_FIBERS
+            fibers.resize(size);
+            while (stacks.size() < size)
+                stacks.push_back(new char[FIBER_STACK_SIZE]);
+#endif
+#ifdef NATIVE_WIN32_FIBERS
+            //each fiber runs one work item after another, so it is created once and kept for the next groups
+            if (!scheduler)
+                scheduler = IsThreadAFiber() ? GetCurrentFiber() : ConvertThreadToFiber(NULL);
+            while (fibers.size() < size)
+                fibers.push_back(CreateFiber(FIBER_STACK_SIZE, &WorkGroup::win32FiberMain, NULL));
+#endif
+        }
+
+        void resume(size_t index) {
+            setItem(index);
+
+#ifdef NATIVE_NO_FIBERS
+            //nothing to switch to, the work item runs to its end and barriers do not wait
+            runWorkItem(*launch);
+            finished[index] = 1;
+#else
+            if (!started[index]) {
+                started[index] = 1;
+                startFiber(index);
+            }
+            fiberRunning = true;
+            switchToFiber(index);
+            fiberRunning = false;
+#endif
+        }
+
+#ifdef NATIVE_UCONTEXT_FIBERS
+        /// Makes the fiber at index run a new work item from the start, when it is switched to
+        void startFiber(size_t index) {
+            ucontext_t& fiber = fibers[index];
+            getcontext(&fiber);
+            fiber.uc_stack.ss_sp = stacks[index];
+            fiber.uc_stack.ss_size = FIBER_STACK_SIZE;
+            fiber.uc_link = &scheduler;
+            makecontext(&fiber, &WorkGroup::fiberMain, 0);
+        }
+
+        void switchToFiber(size_t index) {
+            swapcontext(&scheduler, &fibers[index]);
+        }
+
+        void switchToScheduler() {
+            swapcontext(&fibers[current], &scheduler);
+        }
+
+        static void fiberMain();
+
+        ucontext_t scheduler;
+        std::vector<ucontext_t> fibers;
+        std::vector<char*> stacks;
+#endif
+#ifdef NATIVE_WIN32_FIBERS
+        /// Fibers wait in win32FiberMain for their next work item, there is nothing to set up
+        void startFiber(size_t) {
+        }
+
+        void switchToFiber(size_t index) {
+            SwitchToFiber(fibers[index]);
+        }
+
+        void switchToScheduler() {
+            SwitchToFiber(scheduler);
+        }
+
+        static void CALLBACK win32FiberMain(void*);
+
+        void* scheduler;
+        std::vector<void*> fibers;
+#endif
+#ifdef NATIVE_NO_FIBERS
+        void switchToScheduler() {
+        }
+#endif
+
+        const Launch* launch;
+        size_t begin;
+        size_t end;
+        size_t loopEnd;
+        size_t current;
+        bool fibersStarted;
+        bool fiberRunning;
+
+        std::vector<char> started;
+        std::vector<char> finished;
+    };
+
+    thread_local WorkGroup workGroup;
+
+#ifdef NATIVE_UCONTEXT_FIBERS
+    void WorkGroup::fiberMain() {
+        WorkGroup& group = workGroup;
+        runWorkItem(*group.launch);
+        group.finished[group.current] = 1;
+    }
+#endif
+#ifdef NATIVE_WIN32_FIBERS
+    void CALLBACK WorkGroup::win32FiberMain(void*) {
+        //a Windows fiber must not return, it would end the thread
+        for (;;) {
+            WorkGroup& group = workGroup;
+            runWorkItem(*group.launch);
+            group.finished[group.current] = 1;
+            group.switchToScheduler();
+        }
+    }
+#endif
+
+    void runTask(const Task& task) {
+        const Launch& launch = *task.launch;
+
+        GPAPI::NativeWorkItem& item = nativeWorkItem;
+        item.globalSize = launch.globalSize;
+        item.localSize = launch.localSize;
+        item.numGroups = launch.numGroups;
+        item.dims = launch.dims;
+        for (int i = 0; i < GPAPI::NDRange::MAX_DIMS; ++i) {
+            item.globalSizes[i] = launch.globalSizes[i];
+            item.localSizes[i] = launch.localSizes[i];
+            item.groupCounts[i] = launch.groupCounts[i];
+        }
+
+        //a kernel that uses FOR_EACH_ITEM runs the rest of the chunk in one loop from the first work item of a group
+        WorkGroup& group = workGroup;
+        for (size_t groupBegin = task.begin; groupBegin < task.end; groupBegin += launch.localSize) {
+            item.groupID = groupBegin / launch.localSize;
+            if (group.run(launch, groupBegin, std::min(task.end, groupBegin + launch.localSize), task.end))
+                break;
+        }
+    }
+}
+
+void GPAPI::nativeBarrier() {
+    WorkGroup& group = workGroup;
+    if (group.inFiber())
+        group.barrier();
+    else
+        group.firstItemBarrier();
+}
+
+struct GPAPI::NativeDevice::ThreadPool {
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    ThreadPool(size_t numThreads):workers(numThreads), queued(0), quit(false), nextWorker(0) {
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i] = new Worker;
+        for (size_t i = 0; i < workers.size(); ++i)
+            threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            quit = true;
+        }
+        wakeUp.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+        for (size_t i = 0; i < workers.size(); ++i)
+            delete workers[i];
+        for (size_t i = 0; i < freeLaunches.size(); ++i)
+            delete freeLaunches[i];
+    }
+
+    std::shared_ptr<NativeEvent> submit(KernelLaunch& kernelLaunch, const NDRange& global, NDRange local, const NativeEvents& waitFor, size_t lane) {
+        std::shared_ptr<NativeEvent> event = std::make_shared<NativeEvent>();
+        if (local.getTotal() == 0)
+            local = NDRange(1, 1, 1);
+        size_t numTasks = global.getTotal();
+        const size_t groupSize = local.getTotal();
+        const NativeKernelInfo* kernel = kernelLaunch.kernel ? kernelLaunch.kernel->get() : NULL;
+        if (groupSize > MAX_GROUP_SIZE) {
+            printLog(LogTypeError, "native work-group size %i is bigger than the maximum %i\n", (int)groupSize, (int)MAX_GROUP_SIZE);
+            numTasks = 0;
+        } else if (!kernel) {
+            printLog(LogTypeError, "no native kernel is set\n");
+            numTasks = 0;
+        } else if (kernelLaunch.numParams != kernel->numArgs) {
+            printLog(LogTypeError, "native kernel %s takes %i arguments, %i are set\n", kernel->name, kernel->numArgs, kernelLaunch.numParams);
+            numTasks = 0;
+        }
+        if (numTasks == 0) {
+            whenAll(waitFor, [event]() { event->signal(); });
+            return event;
+        }
+        checkArgs(kernelLaunch, *kernel);
+
+        Launch* launch = allocLaunch();
+        launch->invoke = kernel->invoke;
+        launch->globalSize = numTasks;
+        launch->localSize = groupSize;
+        launch->numGroups = (numTasks + groupSize - 1) / groupSize;
+        launch->dims = std::max(1, global.getDims());
+        for (int i = 0; i < NDRange::MAX_DIMS; ++i) {
+            launch->globalSizes[i] = global[i];
+            launch->localSizes[i] = local[i];
+            launch->groupCounts[i] = (global[i] + local[i] - 1) / local[i];
+        }
+        const size_t groupsPerChunk = std::max<size_t>(1, kernelLaunch.chunkSize ? kernelLaunch.chunkSize / groupSize : launch->numGroups / (workers.size() * CHUNKS_PER_THREAD));
+        launch->chunkSize = groupsPerChunk * groupSize;
+        launch->numChunks = (numTasks + launch->chunkSize - 1) / launch->chunkSize;
+        launch->lane = lane;
+        launch->pending = launch->numChunks;
+        launch->event = event;
+        launch->setParams(kernelLaunch);
+
+        whenAll(waitFor, [this, launch]() { enqueue(launch); });
+        return event;
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    /// \return Lane for a launch, that is not on a queue. Each launch starts from a different worker, so concurrent launches do not pile up on the same queues
+    size_t nextLane() {
+        return nextWorker.fetch_add(1);
+    }
+
+private:
+    /// Fails, if an argument of kernelLaunch is a buffer, where the kernel takes a value, or the other way round, or a value of another size than the kernel takes. Native buffer arguments have size 0 in KernelLaunch::paramsSizes
+    static void checkArgs(const KernelLaunch& kernelLaunch, const NativeKernelInfo& kernel) {
+        for (int i = 0; i < kernel.numArgs; ++i) {
+            const bool isBuffer = kernelLaunch.paramsSizes[i] == 0;
+            int err = (isBuffer == kernel.argIsPointer[i] && (isBuffer || kernelLaunch.paramsSizes[i] == kernel.argSizes[i])) ? 0 : -1;
+            if (err && kernel.argIsPointer[i])
+                printLog(LogTypeError, "native kernel %s takes a buffer as argument %i, it is set to a value of %i bytes\n", kernel.name, i, (int)kernelLaunch.paramsSizes[i]);
+            else if (err && isBuffer)
+                printLog(LogTypeError, "native kernel %s takes a value of %i bytes as argument %i, it is set to a buffer\n", kernel.name, (int)kernel.argSizes[i], i);
+            else if (err)
+                printLog(LogTypeError, "native kernel %s takes a value of %i bytes as argument %i, it is set to one of %i bytes\n", kernel.name, (int)kernel.argSizes[i], i, (int)kernelLaunch.paramsSizes[i]);
+            CHECK_ERROR(err);
+        }
+    }
+
+    /// Spreads the chunks of the launch over the worker queues
+    void enqueue(Launch* launch) {
+        size_t worker = launch->lane;
+        for (size_t i = 0; i < launch->numChunks; ++i, ++worker) {
+            Task task;
+            task.launch = launch;
+            task.begin = i * launch->chunkSize;
+            task.end = std::min(launch->globalSize, task.begin + launch->chunkSize);
+
+            Worker& w = *workers[worker % workers.size()];
+            std::lock_guard<std::mutex> guard(w.lock);
+            w.tasks.push_back(task);
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            queued += launch->numChunks;
+        }
+        wakeUp.notify_all();
+    }
+
+    Launch* allocLaunch() {
+        {
+            std::lock_guard<std::mutex> guard(freeLaunchesLock);
+            if (!freeLaunches.empty()) {
+                Launch* launch = freeLaunches.back();
+                freeLaunches.pop_back();
+                return launch;
+            }
+        }
+        return new Launch;
+    }
+
+    void freeLaunch(Launch* launch) {
+        launch->event.reset();
+        std::lock_guard<std::mutex> guard(freeLaunchesLock);
+        freeLaunches.push_back(launch);
+    }
+
+    void workerLoop(size_t index) {
+        for (;;) {
+            Task task;
+            if (pop(index, task) || steal(index, task)) {
+                execute(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(sleepLock);
+            while (!quit && queued == 0)
+                wakeUp.wait(guard);
+            if (quit)
+                return;
+        }
+    }
+
+    /// Takes the most recently added task of the worker's own queue
+    bool pop(size_t index, Task& task) {
+        Worker& w = *workers[index];
+        std::lock_guard<std::mutex> guard(w.lock);
+        if (w.tasks.empty())
+            return false;
+        task = w.tasks.back();
+        w.tasks.pop_back();
+        taken();
+        return true;
+    }
+
+    /// Takes the oldest task from any worker queue, starting with the one after index
+    bool steal(size_t index, Task& task) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            Worker& w = *workers[(index + i) % workers.size()];
+            std::lock_guard<std::mutex> guard(w.lock);
+            if (w.tasks.empty())
+                continue;
+            task = w.tasks.front();
+            w.tasks.pop_front();
+            taken();
+            return true;
+        }
+        return false;
+    }
+
+    void taken() {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        --queued;
+    }
+
+    void execute(const Task& task) {
+        runTask(task);
+        if (task.launch->pending.fetch_sub(1) == 1) {
+            std::shared_ptr<NativeEvent> event = task.launch->event;
+            freeLaunch(task.launch);
+            event->signal();
+        }
+    }
+
+    std::vector<Worker*> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+    size_t queued;
+    bool quit;
+
+    std::mutex freeLaunchesLock;
+    std::vector<Launch*> freeLaunches;
+
+    std::atomic<size_t> nextWorker;
+};
+
+struct GPAPI::NativeDevice::CopyThread {
+    /// A copy of bytes from src to dst, or a fill of dst with pattern if src is NULL
+    struct Copy {
+        void* dst;
+        const void* src;
+        size_t bytes;
+        char pattern[MAX_FILL_PATTERN_SIZE];
+        size_t patternSize;
+        std::shared_ptr<NativeEvent> event;
+    };
+
+    CopyThread():quit(false), thread(&CopyThread::copyLoop, this) {
+    }
+
+    ~CopyThread() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            quit = true;
+        }
+        wakeUp.notify_all();
+        thread.join();
+    }
+
+    std::shared_ptr<NativeEvent> push(void* dst, const void* src, size_t bytes, const void* pattern, size_t patternSize, const NativeEvents& waitFor) {
+        Copy copy;
+        copy.dst = dst;
+        copy.src = src;
+        copy.bytes = bytes;
+        copy.patternSize = std::min<size_t>(patternSize, MAX_FILL_PATTERN_SIZE);
+        if (pattern)
+            memcpy(copy.pattern, pattern, copy.patternSize);
+        copy.event = std::make_shared<NativeEvent>();
+        whenAll(waitFor, [this, copy]() {
+            //notified under the lock, this may run on a worker thread while the device is being destroyed
+            std::lock_guard<std::mutex> guard(lock);
+            copies.push_back(copy);
+            wakeUp.notify_one();
+        });
+        return copy.event;
+    }
+
+private:
+    void copyLoop() {
+        for (;;) {
+            Copy copy;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!quit && copies.empty())
+                    wakeUp.wait(guard);
+                //the pending copies are finished before quitting, nobody should wait forever for their events
+                if (copies.empty())
+                    return;
+                copy = copies.front();
+                copies.pop_front();
+            }
+            if (copy.src)
+                memcpy(copy.dst, copy.src, copy.bytes);
+            else
+                fill(copy);
+            copy.event->signal();
+        }
+    }
+
+    /// Writes the pattern once, then doubles the filled part with each memcpy
+    static void fill(const Copy& copy) {
+        char* dst = (char*)copy.dst;
+        size_t filled = std::min(copy.patternSize, copy.bytes);
+        memcpy(dst, copy.pattern, filled);
+        while (filled < copy.bytes) {
+            //whole patterns only, so the next copy starts at a pattern boundary
+            const size_t chunk = std::min(filled, copy.bytes - filled);
+            memcpy(dst + filled, dst, chunk);
+            filled += chunk;
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable wakeUp;
+    std::deque<Copy> copies;
+    bool quit;
+    std::thread thread;
 };
 
-void GPAPI::NativeDevice::launchKernel(KernelLaunch& kernelLaunch, size_t numTasks) {
-    for (int i = 0; i < numTasks; ++i) {
-        threadIdx = i;
-        
-        int** paramsPtrs = (int**)kernelLaunch.ptrs;
-        
-        vecAdd(paramsPtrs[D_A],
-               paramsPtrs[D_B],
-               paramsPtrs[D_RES],
-               *(int*)paramsPtrs[COUNT]);
+GPAPI::NativeEvent::NativeEvent():done(false) {
+}
+
+void GPAPI::NativeEvent::signal() {
+    std::vector<std::function<void()> > actions;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        actions.swap(continuations);
+    }
+    doneSignal.notify_all();
+    //outside of the lock, the actions may signal or wait for other events
+    for (size_t i = 0; i < actions.size(); ++i)
+        actions[i]();
+}
+
+void GPAPI::NativeEvent::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!done)
+        doneSignal.wait(guard);
+}
+
+bool GPAPI::NativeEvent::isDone() {
+    std::lock_guard<std::mutex> guard(lock);
+    return done;
+}
+
+void GPAPI::NativeEvent::then(const std::function<void()>& action) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!done) {
+            continuations.push_back(action);
+            return;
+        }
+    }
+    action();
+}
+
+void GPAPI::whenAll(const NativeEvents& events, const std::function<void()>& action) {
+    if (events.empty()) {
+        action();
+        return;
+    }
+    std::shared_ptr<std::atomic<size_t> > pending = std::make_shared<std::atomic<size_t> >(events.size());
+    for (size_t i = 0; i < events.size(); ++i) {
+        events[i]->then([pending, action]() {
+            if (pending->fetch_sub(1) == 1)
+                action();
+        });
+    }
+}
+
+GPAPI::NativeQueue::NativeQueue(size_t lane):lane(lane) {
+}
+
+void GPAPI::NativeQueue::wait() {
+    std::shared_ptr<NativeEvent> event;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        event = last;
+    }
+    //the operations on the queue run in order, so the last one is done only after all the others
+    if (event)
+        event->wait();
+}
+
+GPAPI::NativeDevice::NativeDevice() {
+    size_t numThreads = std::thread::hardware_concurrency();
+    //GPAPI_NATIVE_THREADS overrides the number of cores, e.g. to measure how launches scale with the threads
+    if (const char* threads = getenv("GPAPI_NATIVE_THREADS"))
+        numThreads = strtoul(threads, NULL, 10);
+    pool = new ThreadPool(numThreads ? numThreads : 1);
+    copies = new CopyThread;
+}
+
+GPAPI::NativeDevice::~NativeDevice() {
+    delete copies;
+    delete pool;
+}
+
+std::shared_ptr<GPAPI::NativeEvent> GPAPI::NativeDevice::launchKernel(KernelLaunch& kernelLaunch, const NDRange& global, const NDRange& local, const NativeEvents& waitFor, NativeQueue* queue) {
+    if (!queue)
+        return pool->submit(kernelLaunch, global, local, waitFor, pool->nextLane());
+
+    //the queue stays locked until the launch becomes its last operation, so concurrent launches on it are still ordered
+    std::lock_guard<std::mutex> guard(queue->lock);
+    NativeEvents deps(waitFor);
+    if (queue->last)
+        deps.push_back(queue->last);
+    queue->last = pool->submit(kernelLaunch, global, local, deps, queue->lane);
+    return queue->last;
+}
+
+size_t GPAPI::NativeDevice::getNumThreads() const {
+    return pool->size();
+}
+
+size_t GPAPI::NativeDevice::getMaxGroupSize() const {
+    return MAX_GROUP_SIZE;
+}
+
+std::shared_ptr<GPAPI::NativeEvent> GPAPI::NativeDevice::copyAsync(void* dst, const void* src, size_t bytes, const NativeEvents& waitFor, NativeQueue* queue) {
+    return pushCopy(dst, src, bytes, NULL, 0, waitFor, queue);
+}
+
+std::shared_ptr<GPAPI::NativeEvent> GPAPI::NativeDevice::fillAsync(void* dst, const void* pattern, size_t patternSize, size_t bytes, const NativeEvents& waitFor, NativeQueue* queue) {
+    if (patternSize == 0 || patternSize > MAX_FILL_PATTERN_SIZE) {
+        printLog(LogTypeError, "fill pattern should be 1 to %i bytes\n", (int)MAX_FILL_PATTERN_SIZE);
+        bytes = 0;
+    }
+    return pushCopy(dst, NULL, bytes, pattern, patternSize, waitFor, queue);
+}
+
+std::shared_ptr<GPAPI::NativeEvent> GPAPI::NativeDevice::pushCopy(void* dst, const void* src, size_t bytes, const void* pattern, size_t patternSize, const NativeEvents& waitFor, NativeQueue* queue) {
+    if (!queue)
+        return copies->push(dst, src, bytes, pattern, patternSize, waitFor);
+
+    std::lock_guard<std::mutex> guard(queue->lock);
+    NativeEvents deps(waitFor);
+    if (queue->last)
+        deps.push_back(queue->last);
+    queue->last = copies->push(dst, src, bytes, pattern, patternSize, deps);
+    return queue->last;
+}
+
+GPAPI::NativeKernelRegistrar::NativeKernelRegistrar(const char* name, NativeKernelInfo::Invoke invoke, int numArgs, const size_t* argSizes, const bool* argIsPointer, const char* defines) {
+    NativeKernelInfo info;
+    info.name = name;
+    info.defines = defines;
+    info.invoke = invoke;
+    info.numArgs = numArgs;
+    info.argSizes = argSizes;
+    info.argIsPointer = argIsPointer;
+    getNativeKernels().push_back(info);
+}
+
+const GPAPI::NativeKernelInfo* GPAPI::findNativeKernel(const char* name, const char* defines) {
+    const std::vector<NativeKernelInfo>& kernels = getNativeKernels();
+    for (size_t i = 0; i < kernels.size(); ++i) {
+        if (!strcmp(kernels[i].name, name) && !strcmp(kernels[i].defines, defines))
+            return &kernels[i];
     }
+    return NULL;
 }
 
 GPAPI::NativeDevice* GPAPI::getNativeDevice(){
@@ -39,4 +785,4 @@ GPAPI::NativeDevice* GPAPI::getNativeDevice(){
 }
 
 
-#endif
\ No newline at end of file
+#endif
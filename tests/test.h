@@ -0,0 +1,42 @@
+#pragma once
+
+#include "gpapi.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/// \brief Minimal checks for the tests. Each test is an executable, that returns the number of failed checks, so ctest reports it as failed
+namespace test {
+    inline int& failures() {
+        static int count = 0;
+        return count;
+    }
+
+    /// Prints the summary. \return The exit code of the test
+    inline int result() {
+        if (failures())
+            printf("%i checks failed\n", failures());
+        else
+            printf("all checks passed\n");
+        return failures() ? 1 : 0;
+    }
+
+    /// \return The native devices of initGPAPI (the source is not used on the native target)
+    inline std::vector<GPAPI::Device*> initDevices(int count = 1) {
+        std::vector<GPAPI::Device*> devices;
+        GPAPI::InitParams initParams;
+        initParams.nativeDevices = count;
+        GPAPI::initGPAPI(devices, std::string(), initParams);
+        return devices;
+    }
+}
+
+/// Counts a failure and prints the condition, if X is false. The test goes on
+#define TEST_CHECK(X) \
+    do { \
+        if (!(X)) { \
+            printf("%s:%i: check failed: %s\n", __FILE__, __LINE__, #X); \
+            ++test::failures(); \
+        } \
+    } while (0)
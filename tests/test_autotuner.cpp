@@ -0,0 +1,97 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! Autotuner on the native target with an injected timer, so the winner does not depend on the machine. The tuning database is tuning_test.db under the working directory
+ */
+namespace {
+    const char* DATABASE = "tuning_test.db";
+    const unsigned int NUM_ITEMS = 8192;
+    const size_t FASTEST_CHUNK = 4096;
+
+    struct BindVecAdd {
+        Buffer *a, *b, *c;
+        void operator()(Device& device) {
+            device.addParam(*a);
+            device.addParam(*b);
+            device.addParam(*c);
+            device.addParam(NUM_ITEMS);
+        }
+    };
+
+    /// Runs each candidate once and reports FASTEST_CHUNK as the fastest one
+    struct FakeTimer : TuningTimer {
+        FakeTimer():calls(0) {
+        }
+
+        double measure(const LaunchConfig& config, TuningRun& launch) {
+            ++calls;
+            launch.run();
+            return config.chunkSize == FASTEST_CHUNK ? 1.0 : 5.0 + calls;
+        }
+
+        int calls;
+    };
+}
+
+int main() {
+    remove(DATABASE);
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    std::vector<int> a(NUM_ITEMS, 1), b(NUM_ITEMS, 2), c(NUM_ITEMS);
+    {
+        Buffer bufferA, bufferB, bufferC;
+        device.initBuffer(bufferA, &a[0], NUM_ITEMS * sizeof(int));
+        device.initBuffer(bufferB, &b[0], NUM_ITEMS * sizeof(int));
+        device.initBuffer(bufferC, NULL, NUM_ITEMS * sizeof(int));
+        BindVecAdd bind = { &bufferA, &bufferB, &bufferC };
+
+        //the native candidates are chunk sizes
+        const std::vector<LaunchConfig> candidates = Autotuner::makeCandidates(device, "vecAdd", NDRange(NUM_ITEMS));
+        bool hasFastest = false;
+        for (size_t i = 0; i < candidates.size(); ++i)
+            hasFastest = hasFastest || candidates[i].chunkSize == FASTEST_CHUNK;
+        TEST_CHECK(candidates.size() > 1 && hasFastest);
+
+        {
+            TuningDatabase database(DATABASE);
+            FakeTimer timer;
+            Autotuner tuner(database, &timer);
+            const LaunchConfig best = tuner.tune(device, "vecAdd", NDRange(NUM_ITEMS), bind);
+            TEST_CHECK(best.chunkSize == FASTEST_CHUNK);
+            TEST_CHECK(timer.calls == (int)candidates.size() && tuner.getNumMeasured() == timer.calls);
+
+            //the winner gives the right results
+            Autotuner::prepare(device, "vecAdd", best, bind);
+            device.launchKernel(NDRange(NUM_ITEMS), best.local).wait();
+            bufferC.download(device.getQueue(), device.getContext(), &c[0], NUM_ITEMS * sizeof(int));
+            TEST_CHECK(c == std::vector<int>(NUM_ITEMS, 4));
+        }
+        {
+            //a later run reads the entry from the file, also for a size in the same bucket, and measures nothing
+            TuningDatabase database(DATABASE);
+            TEST_CHECK(database.size() == 1);
+            FakeTimer timer;
+            Autotuner tuner(database, &timer);
+            const LaunchConfig found = tuner.tune(device, "vecAdd", NDRange(NUM_ITEMS - 100), bind);
+            TEST_CHECK(found.chunkSize == FASTEST_CHUNK);
+            TEST_CHECK(timer.calls == 0 && tuner.getNumMeasured() == 0);
+
+            //another bucket is tuned and stored next to it
+            tuner.tune(device, "vecAdd", NDRange(NUM_ITEMS / 2), bind);
+            TEST_CHECK(timer.calls > 0);
+        }
+        TEST_CHECK(TuningDatabase(DATABASE).size() == 2);
+        TEST_CHECK(TuningDatabase::makeKey("GPU", "k", NDRange(1000)) == TuningDatabase::makeKey("GPU", "k", NDRange(1024)));
+        TEST_CHECK(TuningDatabase::makeKey("GPU", "k", NDRange(1000)) != TuningDatabase::makeKey("GPU", "k", NDRange(1025)));
+
+        //variants multiply the candidates
+        std::vector<KernelDefines> variants(2);
+        variants[1]["TILE"] = "4";
+        TEST_CHECK(Autotuner::makeCandidates(device, "tileSum", NDRange(NUM_ITEMS / 4), variants).size() > Autotuner::makeCandidates(device, "tileSum", NDRange(NUM_ITEMS / 4)).size());
+
+        device.freeMem();
+    }
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,106 @@
+#include "test.h"
+
+#include <cstring>
+
+using namespace GPAPI;
+
+/*! BufferArena and Buffer::initView on the native target: each part is a view at its aligned offset of the arena, and writes to a view (from the host or by a kernel) change only its own bytes
+ */
+namespace {
+    const int NUM_PARTS = 5;
+    const unsigned int NUM_ITEMS = 24;
+    const unsigned char MARK = 0xEE;
+
+    /// \return The bytes of buffer, read with one download
+    std::vector<unsigned char> contents(Device& device, Buffer& buffer, size_t bytes) {
+        std::vector<unsigned char> result(bytes);
+        buffer.download(device.getQueue(), device.getContext(), &result[0], bytes);
+        return result;
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    GPU_QUEUE queue = device.getQueue();
+    Context context = device.getContext();
+    const size_t alignment = BufferArena::getAlignment(device.getID());
+
+    //parts of odd sizes, so most of them start after a gap. The third one has no data to upload
+    const size_t sizes[NUM_PARTS] = { 10, 100, 7, NUM_ITEMS * sizeof(int), 3 };
+    std::vector<std::vector<unsigned char> > data(NUM_PARTS);
+    for (int p = 0; p < NUM_PARTS; ++p) {
+        data[p].resize(sizes[p]);
+        for (size_t i = 0; i < sizes[p]; ++i)
+            data[p][i] = (unsigned char)(p * 40 + i % 37 + 1);
+    }
+    {
+        BufferArena arena;
+        arena.init(device.getID(), context);
+        Buffer* parts[NUM_PARTS];
+        size_t offsets[NUM_PARTS];
+        size_t end = 0;
+        for (int p = 0; p < NUM_PARTS; ++p) {
+            parts[p] = arena.add(p == 2 ? NULL : &data[p][0], sizes[p]);
+            offsets[p] = (end + alignment - 1) / alignment * alignment;
+            end = offsets[p] + sizes[p];
+        }
+        TEST_CHECK(arena.getSize() == end);
+        arena.upload(queue, &device.getMemoryPool());
+
+        //each view is at its aligned offset of the arena and has the data of its part
+        std::vector<unsigned char> all = contents(device, arena.getBuffer(), arena.getSize());
+        for (int p = 0; p < NUM_PARTS; ++p) {
+            TEST_CHECK(offsets[p] % alignment == 0);
+            TEST_CHECK((char*)parts[p]->get() == (char*)arena.getBuffer().get() + offsets[p]);
+            if (p != 2) {
+                TEST_CHECK(!memcmp(&all[offsets[p]], &data[p][0], sizes[p]));
+                TEST_CHECK(contents(device, *parts[p], sizes[p]) == data[p]);
+            }
+        }
+
+        //an upload to a view changes only its own bytes
+        const std::vector<unsigned char> marks(sizes[1], MARK);
+        parts[1]->uploadAsync(queue, context, &marks[0], marks.size()).wait();
+        std::vector<unsigned char> after = contents(device, arena.getBuffer(), arena.getSize());
+        TEST_CHECK(!memcmp(&after[offsets[1]], &marks[0], marks.size()));
+        memcpy(&all[offsets[1]], &marks[0], marks.size());
+        TEST_CHECK(after == all);
+
+        //a kernel, that writes one view, leaves its neighbours as they are: vecAdd of the first NUM_ITEMS ints of part 1 (twice) into part 3
+        device.setKernel("vecAdd");
+        device.addParam(parts[1]);
+        device.addParam(parts[1]);
+        device.addParam(parts[3]);
+        device.addParam(NUM_ITEMS);
+        device.launchKernel(NUM_ITEMS, 8);
+        device.wait();
+        after = contents(device, arena.getBuffer(), arena.getSize());
+        const int* in = (const int*)&after[offsets[1]];
+        const int* out = (const int*)&after[offsets[3]];
+        int bad = 0;
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            bad += out[i] != 2 * in[i] + 1;
+        TEST_CHECK(bad == 0);
+        TEST_CHECK(!memcmp(&after[0], &all[0], offsets[3]) && !memcmp(&after[offsets[4]], &all[offsets[4]], sizes[4]));
+        device.freeMem();
+    }
+    {
+        //a view of a plain buffer
+        const size_t bytes = 512;
+        std::vector<unsigned char> host(bytes);
+        for (size_t i = 0; i < bytes; ++i)
+            host[i] = (unsigned char)(i % 251);
+        Buffer parent, view;
+        parent.init(queue, context, &host[0], bytes);
+        view.initView(parent, 128, 64);
+        TEST_CHECK(contents(device, view, 64) == std::vector<unsigned char>(host.begin() + 128, host.begin() + 192));
+        const std::vector<unsigned char> marks(64, MARK);
+        view.uploadAsync(queue, context, &marks[0], marks.size()).wait();
+        std::copy(marks.begin(), marks.end(), host.begin() + 128);
+        TEST_CHECK(contents(device, parent, bytes) == host);
+        view.freeMem();
+    }
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,118 @@
+#include "test.h"
+
+#include <cstring>
+
+using namespace GPAPI;
+
+/*! Transfers of a part of a buffer on the native target: upload and download at an offset (blocking and async), copyTo between buffers and inside one, and fill with patterns of several sizes.
+ Each check looks at the bytes on both edges of the range and at the bytes around it, that should be untouched.
+ With "upload", "download", "copy" or "fill" on the command line a range ends past the buffer and the call has to stop the program with an error (see tests/CMakeLists.txt)
+ */
+namespace {
+    const size_t BYTES = 1024;
+    const unsigned char UNTOUCHED = 0xAB;
+
+    /// \return The BYTES bytes of buffer, read with one download
+    std::vector<unsigned char> contents(Device& device, Buffer& buffer) {
+        std::vector<unsigned char> bytes(BYTES);
+        buffer.download(device.getQueue(), device.getContext(), &bytes[0], bytes.size());
+        return bytes;
+    }
+
+    /// Sets the BYTES bytes of buffer to UNTOUCHED
+    void reset(Device& device, Buffer& buffer) {
+        const std::vector<unsigned char> bytes(BYTES, UNTOUCHED);
+        buffer.upload(device.getQueue(), device.getContext(), &bytes[0], bytes.size());
+    }
+
+    /// \return true if the bytes outside of [begin, end) are all UNTOUCHED
+    bool untouchedOutside(const std::vector<unsigned char>& bytes, size_t begin, size_t end) {
+        for (size_t i = 0; i < bytes.size(); ++i)
+            if ((i < begin || i >= end) && bytes[i] != UNTOUCHED)
+                return false;
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    const std::string outOfRange = argc > 1 ? argv[1] : "";
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    GPU_QUEUE queue = device.getQueue();
+    Context context = device.getContext();
+
+    std::vector<unsigned char> source(BYTES);
+    for (size_t i = 0; i < BYTES; ++i)
+        source[i] = (unsigned char)(i % 199);
+    {
+        Buffer buffer, other;
+        buffer.init(queue, context, NULL, BYTES);
+        other.init(queue, context, NULL, BYTES);
+        if (outOfRange == "upload")
+            buffer.upload(queue, context, &source[0], 8, BYTES - 4);
+        else if (outOfRange == "download")
+            buffer.downloadAsync(queue, context, &source[0], BYTES, Events(), 1).wait();
+        else if (outOfRange == "copy")
+            buffer.copyTo(queue, context, other, 0, BYTES - 16, 32).wait();
+        else if (outOfRange == "fill")
+            buffer.fill(queue, context, &UNTOUCHED, 1, 1000, 100).wait();
+
+        //upload at an offset writes exactly [offset, offset + bytes)
+        reset(device, buffer);
+        buffer.upload(queue, context, &source[0], 100, 37);
+        std::vector<unsigned char> bytes = contents(device, buffer);
+        TEST_CHECK(!memcmp(&bytes[37], &source[0], 100) && untouchedOutside(bytes, 37, 137));
+
+        //the async one up to the last byte of the buffer
+        reset(device, buffer);
+        buffer.uploadAsync(queue, context, &source[0], 24, Events(), BYTES - 24).wait();
+        bytes = contents(device, buffer);
+        TEST_CHECK(!memcmp(&bytes[BYTES - 24], &source[0], 24) && untouchedOutside(bytes, BYTES - 24, BYTES));
+
+        //download at an offset reads the range and leaves the rest of the host memory as it is
+        buffer.upload(queue, context, &source[0], BYTES);
+        std::vector<unsigned char> host(BYTES, UNTOUCHED);
+        buffer.download(queue, context, &host[10], 50, 200);
+        TEST_CHECK(!memcmp(&host[10], &source[200], 50) && untouchedOutside(host, 10, 60));
+        std::fill(host.begin(), host.end(), UNTOUCHED);
+        buffer.downloadAsync(queue, context, &host[0], 1, Events(), BYTES - 1).wait();
+        TEST_CHECK(host[0] == source[BYTES - 1] && untouchedOutside(host, 0, 1));
+
+        //copyTo another buffer and to another range of the same buffer
+        reset(device, other);
+        buffer.copyTo(queue, context, other, 100, 300, 64).wait();
+        bytes = contents(device, other);
+        TEST_CHECK(!memcmp(&bytes[300], &source[100], 64) && untouchedOutside(bytes, 300, 364));
+        buffer.copyTo(queue, context, buffer, 0, 512, 128).wait();
+        bytes = contents(device, buffer);
+        TEST_CHECK(!memcmp(&bytes[512], &source[0], 128));
+        TEST_CHECK(!memcmp(&bytes[0], &source[0], 512) && !memcmp(&bytes[640], &source[640], BYTES - 640));
+        //a copy of 0 bytes does nothing, also at the end of the buffer
+        buffer.copyTo(queue, context, other, BYTES, BYTES, 0).wait();
+
+        //fill with patterns of 1, 2, 4 and 16 bytes, each range a multiple of the pattern
+        const unsigned char pattern[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+        const size_t sizes[] = { 1, 2, 4, 16 };
+        for (int p = 0; p < 4; ++p) {
+            const size_t size = sizes[p];
+            const size_t offset = 8 * size;
+            const size_t count = 5 * size;
+            reset(device, buffer);
+            buffer.fill(queue, context, pattern, size, offset, count).wait();
+            bytes = contents(device, buffer);
+            bool filled = true;
+            for (size_t i = 0; i < count; ++i)
+                filled = filled && bytes[offset + i] == pattern[i % size];
+            TEST_CHECK(filled && untouchedOutside(bytes, offset, offset + count));
+        }
+        //a fill, that ends at the last byte
+        reset(device, buffer);
+        const unsigned int word = 0x01020304;
+        buffer.fill(queue, context, &word, sizeof(word), BYTES - 8, 8).wait();
+        bytes = contents(device, buffer);
+        TEST_CHECK(!memcmp(&bytes[BYTES - 8], &word, 4) && !memcmp(&bytes[BYTES - 4], &word, 4) && untouchedOutside(bytes, BYTES - 8, BYTES));
+    }
+    device.freeMem();
+    freeGPAPI(devices);
+    return test::result();
+}
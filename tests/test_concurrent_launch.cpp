@@ -0,0 +1,94 @@
+#include "test.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace GPAPI;
+
+/*! Several host threads launch native kernels at the same time, each on a device of its own, and check every result.
+ The work-item ids are thread_local, so no launch should see the ids of another one. Build with GPAPI_SANITIZE_THREAD=ON to run it under ThreadSanitizer
+ */
+namespace {
+    const int NUM_THREADS = 4;
+    const int ITERATIONS = 20;
+    const unsigned int NUM_ITEMS = 2048;
+    const unsigned int GROUP_SIZE = 64;
+
+    std::atomic<int> badResults(0);
+
+    /// Launches vecAdd with b[i] = thread, so each thread expects other results
+    void runVecAdd(Device& device, int thread) {
+        std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS, thread), c(NUM_ITEMS);
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            a[i] = i;
+        const size_t bytes = NUM_ITEMS * sizeof(int);
+        for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+            Buffer bufferA = device.createBuffer(&a[0], bytes);
+            Buffer bufferB = device.createBuffer(&b[0], bytes);
+            Buffer result = device.createBuffer(NULL, bytes);
+            device.setKernel("vecAdd");
+            device.addParam(bufferA);
+            device.addParam(bufferB);
+            device.addParam(result);
+            device.addParam(NUM_ITEMS);
+            device.launchKernel(NUM_ITEMS, GROUP_SIZE);
+            device.wait();
+            result.download(device.getQueue(), device.getContext(), &c[0], bytes);
+            for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+                if (c[i] != (int)i + 1 + thread) {
+                    ++badResults;
+                    break;
+                }
+            }
+            device.freeMem();
+        }
+    }
+
+    /// Launches groupSum, that reads localID and groupID and syncs with barriers
+    void runGroupSum(Device& device, int thread) {
+        std::vector<int> a(NUM_ITEMS), sums(NUM_ITEMS / GROUP_SIZE);
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            a[i] = thread + (int)(i % 3);
+        for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+            Buffer bufferA = device.createBuffer(&a[0], NUM_ITEMS * sizeof(int));
+            Buffer result = device.createBuffer(NULL, sums.size() * sizeof(int));
+            device.setKernel("groupSum");
+            device.addParam(bufferA);
+            device.addParam(result);
+            device.addParam(NUM_ITEMS);
+            device.launchKernel(NUM_ITEMS, GROUP_SIZE);
+            device.wait();
+            result.download(device.getQueue(), device.getContext(), &sums[0], sums.size() * sizeof(int));
+            for (size_t g = 0; g < sums.size(); ++g) {
+                int expected = 0;
+                for (unsigned int i = g * GROUP_SIZE; i < (g + 1) * GROUP_SIZE; ++i)
+                    expected += a[i];
+                if (sums[g] != expected) {
+                    ++badResults;
+                    break;
+                }
+            }
+            device.freeMem();
+        }
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices(NUM_THREADS);
+    TEST_CHECK(devices.size() == NUM_THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < (int)devices.size(); ++t) {
+        Device* device = devices[t];
+        threads.push_back(std::thread([device, t]() {
+            if (t % 2)
+                runGroupSum(*device, t);
+            else
+                runVecAdd(*device, t);
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    TEST_CHECK(badResults == 0);
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! Dependencies between operations on two native queues: the upload of a, on the first queue, starts late, behind a big upload on the same queue.
+ The launch on the second queue waits for it and for the upload of b, the download on the first queue waits for the launch. No operation may be done before the ones it waits for
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 4096;
+    const size_t DELAY_BYTES = 64 * 1024 * 1024;
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    device.setNumQueues(2);
+    GPU_QUEUE first = device.getQueue(0);
+    GPU_QUEUE second = device.getQueue(1);
+    Context context = device.getContext();
+
+    const size_t bytes = NUM_ITEMS * sizeof(int);
+    std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS), c(NUM_ITEMS, -1);
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+        a[i] = i;
+        b[i] = 2 * i;
+    }
+    std::vector<char> delayHost(DELAY_BYTES, 1);
+    Buffer delay, bufferA, bufferB, bufferC;
+    delay.init(first, context, NULL, DELAY_BYTES);
+    bufferA.init(first, context, NULL, bytes);
+    bufferB.init(first, context, NULL, bytes);
+    bufferC.init(first, context, NULL, bytes);
+
+    Event delayed = delay.uploadAsync(first, context, &delayHost[0], DELAY_BYTES);
+    Event uploadA = bufferA.uploadAsync(first, context, &a[0], bytes);
+    Event uploadB = bufferB.uploadAsync(second, context, &b[0], bytes);
+    Events launchWaits;
+    launchWaits.push_back(uploadA);
+    launchWaits.push_back(uploadB);
+
+    device.setKernel("vecAdd");
+    device.addParam(&bufferA);
+    device.addParam(&bufferB);
+    device.addParam(&bufferC);
+    device.addParam(NUM_ITEMS);
+    Event launch = device.launchKernel(NUM_ITEMS, 64, launchWaits, 1);
+    Events downloadWaits(1, launch);
+    Event download = bufferC.downloadAsync(first, context, &c[0], bytes, downloadWaits);
+
+    //each operation is done only after the ones it waits for. The launch itself is short, so without its dependencies it would be done long before the delayed upload of a
+    launch.wait();
+    TEST_CHECK(delayed.isDone() && uploadA.isDone() && uploadB.isDone());
+    download.wait();
+    TEST_CHECK(launch.isDone());
+
+    int bad = 0;
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+        bad += c[i] != (int)(3 * i + 1);
+    TEST_CHECK(bad == 0);
+
+    device.freeMem();
+    delay.freeMem();
+    bufferA.freeMem();
+    bufferB.freeMem();
+    bufferC.freeMem();
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,51 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! Arguments of native launches against the signature of the kernel. Without a command line argument the launch matches and has to give the right result.
+ With "value", "buffer" or "size" an argument of vecAdd is set wrong and the launch has to stop the program with an error, that names the kernel and the argument (see tests/CMakeLists.txt).
+ With "set" setParam changes n to a value of another type, which has to stop the program as well
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 1024;
+}
+
+int main(int argc, char** argv) {
+    const std::string mismatch = argc > 1 ? argv[1] : "";
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    std::vector<int> a(NUM_ITEMS, 1), b(NUM_ITEMS, 2), c(NUM_ITEMS);
+    const size_t bytes = NUM_ITEMS * sizeof(int);
+    device.setKernel("vecAdd");
+    Buffer& bufferA = device.addParam(&a[0], bytes);
+    if (mismatch == "value") {
+        //a value where the kernel takes a buffer
+        device.addParam(NUM_ITEMS);
+    } else
+        device.addParam(&b[0], bytes);
+    Buffer& result = device.addParam(NULL, bytes);
+    if (mismatch == "buffer")
+        device.addParam(&b[0], bytes);
+    else if (mismatch == "size")
+        device.addParam((unsigned short)NUM_ITEMS);
+    else
+        device.addParam(NUM_ITEMS);
+    device.launchKernel(NUM_ITEMS, 64);
+    device.wait();
+    result.download(device.getQueue(), device.getContext(), &c[0], bytes);
+    TEST_CHECK(c == std::vector<int>(NUM_ITEMS, 4));
+
+    //setParam changes arguments in place and the others stay bound: b is now a, and n covers half of the items
+    device.setParam(1, bufferA);
+    if (mismatch == "set")
+        device.setParam(3, (unsigned short)(NUM_ITEMS / 2));
+    device.setParam(3, NUM_ITEMS / 2);
+    device.launchKernel(NUM_ITEMS, 64);
+    device.wait();
+    result.download(device.getQueue(), device.getContext(), &c[0], bytes);
+    TEST_CHECK(c[0] == 3 && c[NUM_ITEMS / 2 - 1] == 3);
+    TEST_CHECK(c[NUM_ITEMS / 2] == 4 && c[NUM_ITEMS - 1] == 4);
+    device.freeMem();
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,67 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! Kernel variants on the native target: setKernel("tileSum", defines) picks the instance registered with REGISTER_KERNEL_VARIANT for each TILE, and each gives the sums of its own tile size.
+ With "unknown" on the command line a TILE without a registered variant is set and the program has to stop with an error, that names it (see tests/CMakeLists.txt)
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 1024;
+}
+
+int main(int argc, char** argv) {
+    const bool unknown = argc > 1 && std::string(argv[1]) == "unknown";
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+
+    std::vector<int> a(NUM_ITEMS);
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+        a[i] = i % 10;
+    {
+        Buffer bufferA, bufferSums;
+        bufferA.init(device.getQueue(), device.getContext(), &a[0], NUM_ITEMS * sizeof(int));
+        bufferSums.init(device.getQueue(), device.getContext(), NULL, NUM_ITEMS * sizeof(int));
+        if (unknown) {
+            KernelDefines defines;
+            defines["TILE"] = "5";
+            device.setKernel("tileSum", defines);
+        }
+
+        //the empty defines are the default TILE of 16
+        const char* tiles[] = { "", "4", "16", "64" };
+        for (int t = 0; t < 4; ++t) {
+            KernelDefines defines;
+            if (*tiles[t])
+                defines["TILE"] = tiles[t];
+            const unsigned int tile = *tiles[t] ? (unsigned int)atoi(tiles[t]) : 16;
+            const unsigned int numSums = NUM_ITEMS / tile;
+            std::vector<int> sums(NUM_ITEMS, -1);
+            bufferSums.upload(device.getQueue(), device.getContext(), &sums[0], NUM_ITEMS * sizeof(int));
+
+            device.setKernel("tileSum", defines);
+            device.addParam(bufferA);
+            device.addParam(bufferSums);
+            device.addParam(NUM_ITEMS);
+            device.launchKernel(numSums, 16);
+            device.wait();
+            bufferSums.download(device.getQueue(), device.getContext(), &sums[0], NUM_ITEMS * sizeof(int));
+
+            int bad = 0;
+            for (unsigned int s = 0; s < numSums; ++s) {
+                int expected = 0;
+                for (unsigned int i = s * tile; i < (s + 1) * tile; ++i)
+                    expected += a[i];
+                bad += sums[s] != expected;
+            }
+            //a variant with another TILE would write another number of sums
+            for (unsigned int s = numSums; s < NUM_ITEMS; ++s)
+                bad += sums[s] != -1;
+            if (bad)
+                printf("TILE %u: %i wrong sums\n", tile, bad);
+            TEST_CHECK(bad == 0);
+        }
+        device.freeMem();
+    }
+    freeGPAPI(devices);
+    return test::result();
+}
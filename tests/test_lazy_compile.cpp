@@ -0,0 +1,90 @@
+#include "test.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace GPAPI;
+
+/*! The compile modes of InitParams on the native target. It has no compiler, so this covers the path around the compilation: the first setKernel of each device
+ finds the program (waiting for the background thread of CompileInBackground, that runs at the same time), looks the kernel and its variants up and launches them. Devices, that are freed before any setKernel, join their background threads.
+ Build with GPAPI_SANITIZE_THREAD=ON to check the background thread against setKernel
+ */
+namespace {
+    const int NUM_DEVICES = 3;
+    const unsigned int NUM_ITEMS = 1024;
+
+    std::atomic<int> badResults(0);
+
+    /// \return Devices, that compile in mode
+    std::vector<Device*> initDevices(InitParams::CompileMode mode) {
+        std::vector<Device*> devices;
+        InitParams initParams;
+        initParams.nativeDevices = NUM_DEVICES;
+        initParams.compileMode = mode;
+        initGPAPI(devices, std::string(), initParams);
+        return devices;
+    }
+
+    /// Runs vecAdd and a variant of tileSum right after init, each thread on a device of its own
+    void run(Device& device) {
+        std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS, 2), c(NUM_ITEMS);
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            a[i] = i;
+        Buffer bufferA, bufferB, bufferC;
+        bufferA.init(device.getQueue(), device.getContext(), &a[0], NUM_ITEMS * sizeof(int));
+        bufferB.init(device.getQueue(), device.getContext(), &b[0], NUM_ITEMS * sizeof(int));
+        bufferC.init(device.getQueue(), device.getContext(), NULL, NUM_ITEMS * sizeof(int));
+
+        device.setKernel("vecAdd");
+        device.addParam(bufferA);
+        device.addParam(bufferB);
+        device.addParam(bufferC);
+        device.addParam(NUM_ITEMS);
+        device.launchKernel(NUM_ITEMS, 64);
+        device.wait();
+        bufferC.download(device.getQueue(), device.getContext(), &c[0], NUM_ITEMS * sizeof(int));
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            if (c[i] != (int)i + 3) {
+                ++badResults;
+                break;
+            }
+
+        KernelDefines defines;
+        defines["TILE"] = "4";
+        device.setKernel("tileSum", defines);
+        device.addParam(bufferB);
+        device.addParam(bufferC);
+        device.addParam(NUM_ITEMS);
+        device.launchKernel(NUM_ITEMS / 4, 16);
+        device.wait();
+        bufferC.download(device.getQueue(), device.getContext(), &c[0], NUM_ITEMS / 4 * sizeof(int));
+        for (unsigned int i = 0; i < NUM_ITEMS / 4; ++i)
+            if (c[i] != 8) {
+                ++badResults;
+                break;
+            }
+        device.freeMem();
+    }
+}
+
+int main() {
+    const InitParams::CompileMode modes[] = { InitParams::CompileAtInit, InitParams::CompileOnFirstUse, InitParams::CompileInBackground };
+    for (int m = 0; m < 3; ++m) {
+        std::vector<Device*> devices = initDevices(modes[m]);
+        TEST_CHECK(devices.size() == NUM_DEVICES);
+        std::vector<std::thread> threads;
+        for (size_t d = 0; d < devices.size(); ++d)
+            threads.push_back(std::thread(run, std::ref(*devices[d])));
+        for (size_t t = 0; t < threads.size(); ++t)
+            threads[t].join();
+        TEST_CHECK(badResults == 0);
+        badResults = 0;
+        freeGPAPI(devices);
+
+        //devices, that are never used
+        devices = initDevices(modes[m]);
+        TEST_CHECK(devices.size() == NUM_DEVICES);
+        freeGPAPI(devices);
+    }
+    return test::result();
+}
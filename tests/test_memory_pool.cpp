@@ -0,0 +1,101 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/// Size classes, hits and misses, the high-water mark and trim of the memory pool of a native device, and the buffers of the caller, that draw from it
+int main() {
+    //four classes per power of two, at most a quarter of an allocation unused
+    TEST_CHECK(MemoryPool::getSizeClass(1) == 256);
+    TEST_CHECK(MemoryPool::getSizeClass(256) == 256);
+    TEST_CHECK(MemoryPool::getSizeClass(257) == 320);
+    TEST_CHECK(MemoryPool::getSizeClass(4096) == 4096);
+    TEST_CHECK(MemoryPool::getSizeClass(4097) == 5120);
+    for (size_t bytes = 257; bytes < 100000; bytes += 37) {
+        const size_t size = MemoryPool::getSizeClass(bytes);
+        TEST_CHECK(size >= bytes && (size - bytes) * 4 < size);
+    }
+
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    MemoryPool& pool = device.getMemoryPool();
+    const MemoryPool::Stats& stats = pool.getStats();
+
+    device.setKernel("vecAdd");
+    device.addParam(NULL, 4096);
+    device.addParam(NULL, 64 * 1024);
+    TEST_CHECK(stats.misses == 2 && stats.hits == 0);
+    TEST_CHECK(stats.bytesInUse == 4096 + 64 * 1024);
+    device.freeMem();
+    TEST_CHECK(stats.bytesInUse == 0 && stats.bytesCached == 4096 + 64 * 1024);
+
+    //the same size classes come from the cache
+    device.setKernel("vecAdd");
+    device.addParam(NULL, 4000);
+    device.addParam(NULL, 64 * 1024);
+    TEST_CHECK(stats.misses == 2 && stats.hits == 2);
+    TEST_CHECK(stats.bytesCached == 0);
+    device.freeMem();
+
+    //trim releases the biggest first
+    pool.trim(4096);
+    TEST_CHECK(stats.bytesCached == 4096);
+    pool.trim();
+    TEST_CHECK(stats.bytesCached == 0);
+
+    //over the high-water mark, freed memory goes back right away
+    pool.setMaxCachedBytes(8192);
+    device.setKernel("vecAdd");
+    device.addParam(NULL, 4096);
+    device.addParam(NULL, 64 * 1024);
+    device.freeMem();
+    TEST_CHECK(stats.bytesCached <= 8192);
+    pool.setMaxCachedBytes(0);
+    TEST_CHECK(stats.bytesCached == 0);
+
+    //the memory of a pooled buffer is usable
+    pool.setMaxCachedBytes(MemoryPool::DEFAULT_MAX_CACHED_BYTES);
+    std::vector<int> host(1024), back(1024);
+    for (int i = 0; i < 1024; ++i)
+        host[i] = i * 7;
+    for (int round = 0; round < 2; ++round) {
+        device.setKernel("vecAdd");
+        Buffer& buffer = device.addParam(&host[0], host.size() * sizeof(int));
+        buffer.download(device.getQueue(), device.getContext(), &back[0], back.size() * sizeof(int));
+        TEST_CHECK(back == host);
+        device.freeMem();
+    }
+
+    //a buffer of the caller comes from the pool too, outlives freeMem and gives its memory back when it is destroyed
+    const size_t bytes = host.size() * sizeof(int);
+    const size_t inUse = stats.bytesInUse;
+    {
+        Buffer owned;
+        device.initBuffer(owned, &host[0], bytes);
+        TEST_CHECK(stats.bytesInUse == inUse + bytes);
+        for (int round = 0; round < 2; ++round) {
+            device.setKernel("vecAdd");
+            device.addParam(owned);
+            device.addParam(owned);
+            Buffer& result = device.addParam(NULL, bytes);
+            device.addParam((unsigned int)host.size());
+            device.launchKernel(host.size(), 64);
+            result.download(device.getQueue(), device.getContext(), &back[0], bytes);
+            int bad = 0;
+            for (size_t i = 0; i < host.size(); ++i)
+                bad += back[i] != 2 * host[i] + 1;
+            TEST_CHECK(bad == 0);
+            device.freeMem();
+            TEST_CHECK(stats.bytesInUse == inUse + bytes);
+        }
+        //moving a buffer moves its memory, there is still one owner
+        Buffer moved = device.createBuffer(NULL, bytes);
+        void* memory = moved.get();
+        Buffer owner(std::move(moved));
+        TEST_CHECK(owner.get() == memory && moved.get() == NULL);
+        TEST_CHECK(stats.bytesInUse == inUse + 2 * bytes);
+    }
+    TEST_CHECK(stats.bytesInUse == inUse);
+
+    freeGPAPI(devices);
+    return test::result();
+}
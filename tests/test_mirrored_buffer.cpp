@@ -0,0 +1,152 @@
+#include "test.h"
+
+#include <cstring>
+
+using namespace GPAPI;
+
+/*! MirroredBuffer on the native target: the bytes each sync transfers (partial last pages, runs of neighbouring pages, the last writer of a page, write into a page the device changed)
+ and the host data after a kernel writes the buffer through addParam(MirroredBuffer&, true) and read waits for the launch
+ */
+namespace {
+    const size_t PAGE = MirroredBuffer::PAGE_SIZE;
+    /// Three and a half pages, so the last page is partial
+    const size_t BYTES = 3 * PAGE + PAGE / 2;
+    const unsigned int NUM_ITEMS = 4096;
+    /// Size of the upload, that the launch on the second queue waits for, so the launch is still running when the first queue syncs the mirror
+    const size_t DELAY_BYTES = 64 * 1024 * 1024;
+
+    /// Checks the bytes the mirror has uploaded and downloaded since the last call
+    struct Transfers {
+        Transfers(const MirroredBuffer& mirrored):mirror(mirrored), uploaded(mirrored.getUploadedBytes()), downloaded(mirrored.getDownloadedBytes()) {
+        }
+
+        bool since(size_t up, size_t down) {
+            const bool same = mirror.getUploadedBytes() - uploaded == up && mirror.getDownloadedBytes() - downloaded == down;
+            if (!same)
+                printf("uploaded %i bytes, downloaded %i bytes, expected %i and %i\n", (int)(mirror.getUploadedBytes() - uploaded), (int)(mirror.getDownloadedBytes() - downloaded), (int)up, (int)down);
+            uploaded = mirror.getUploadedBytes();
+            downloaded = mirror.getDownloadedBytes();
+            return same;
+        }
+
+        const MirroredBuffer& mirror;
+        size_t uploaded;
+        size_t downloaded;
+    };
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+
+    std::vector<char> host(BYTES), deviceData(BYTES);
+    for (size_t i = 0; i < BYTES; ++i)
+        host[i] = (char)(i % 101);
+    {
+        MirroredBuffer mirror;
+        mirror.init(device.getQueue(), device.getContext(), &host[0], BYTES, &device.getMemoryPool());
+        Transfers transfers(mirror);
+
+        //the first sync sends all of the host memory, the partial last page only up to the end
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(BYTES, 0));
+        mirror.syncToDevice();
+        mirror.syncToHost();
+        TEST_CHECK(transfers.since(0, 0));
+
+        //a change in the partial last page sends only what is left of it
+        mirror.markHostDirty(BYTES - 10, 4);
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(PAGE / 2, 0));
+
+        //bytes across a page border mark both pages, neighbouring pages and a separate one
+        mirror.markHostDirty(PAGE - 2, 4);
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(2 * PAGE, 0));
+        mirror.markHostDirty(0, 1);
+        mirror.markHostDirty(PAGE, 1);
+        mirror.markHostDirty(3 * PAGE, 1);
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(2 * PAGE + PAGE / 2, 0));
+
+        //the last writer of a page wins: the other side drops its change
+        mirror.markHostDirty(10, 10);
+        mirror.markDeviceDirty(10, 10);
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(0, 0));
+        mirror.syncToHost();
+        TEST_CHECK(transfers.since(0, PAGE));
+        mirror.markDeviceDirty(PAGE + 10, 10);
+        mirror.markHostDirty(PAGE + 10, 10);
+        mirror.syncToHost();
+        TEST_CHECK(transfers.since(0, 0));
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(PAGE, 0));
+
+        //write into a page, that the device changed, first downloads that page, so the rest of it is kept
+        for (size_t i = 0; i < BYTES; ++i)
+            deviceData[i] = (char)(i % 37 + 1);
+        mirror.getBuffer().upload(device.getQueue(), device.getContext(), &deviceData[0], BYTES);
+        mirror.markDeviceDirty(2 * PAGE, PAGE);
+        const char written[8] = { -1, -2, -3, -4, -5, -6, -7, -8 };
+        mirror.write(2 * PAGE + 100, written, sizeof(written));
+        TEST_CHECK(transfers.since(0, PAGE));
+        TEST_CHECK(!memcmp(&host[2 * PAGE], &deviceData[2 * PAGE], 100));
+        TEST_CHECK(!memcmp(&host[2 * PAGE + 100], written, sizeof(written)));
+        TEST_CHECK(!memcmp(&host[2 * PAGE + 108], &deviceData[2 * PAGE + 108], PAGE - 108));
+        //the other pages are as the host had them
+        TEST_CHECK(host[PAGE] == (char)(PAGE % 101) && host[3 * PAGE] == (char)(3 * PAGE % 101));
+        mirror.syncToDevice();
+        TEST_CHECK(transfers.since(PAGE, 0));
+        std::vector<char> back(BYTES);
+        mirror.getBuffer().download(device.getQueue(), device.getContext(), &back[0], BYTES);
+        TEST_CHECK(!memcmp(&back[2 * PAGE], &host[2 * PAGE], PAGE));
+    }
+    {
+        //a kernel on the second queue writes the mirror, after a long upload. read syncs on the first queue, so only the use of the launch makes it wait
+        std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS), c(NUM_ITEMS, -1);
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+            a[i] = i;
+            b[i] = 2 * i;
+        }
+        MirroredBuffer mirrorA, mirrorB, mirrorC;
+        mirrorA.init(device.getQueue(), device.getContext(), &a[0], NUM_ITEMS * sizeof(int));
+        mirrorB.init(device.getQueue(), device.getContext(), &b[0], NUM_ITEMS * sizeof(int));
+        mirrorC.init(device.getQueue(), device.getContext(), &c[0], NUM_ITEMS * sizeof(int));
+        device.setNumQueues(2);
+        std::vector<char> delayHost(DELAY_BYTES, 1);
+        Buffer delay;
+        delay.init(device.getQueue(), device.getContext(), NULL, DELAY_BYTES);
+        Events waitFor;
+        waitFor.push_back(delay.uploadAsync(device.getQueue(1), device.getContext(), &delayHost[0], DELAY_BYTES));
+        device.setKernel("vecAdd");
+        device.addParam(mirrorA, false);
+        device.addParam(mirrorB, false);
+        device.addParam(mirrorC, true);
+        device.addParam(NUM_ITEMS);
+        Event launch = device.launchKernel(NUM_ITEMS, 64, waitFor, 1);
+        Transfers transfersC(mirrorC);
+        const int* result = (const int*)mirrorC.read();
+        TEST_CHECK(launch.isDone());
+        TEST_CHECK(transfersC.since(0, NUM_ITEMS * sizeof(int)));
+        int bad = 0;
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            bad += result[i] != (int)(3 * i + 1);
+        TEST_CHECK(bad == 0 && result == &c[0]);
+        TEST_CHECK(waitFor[0].isDone());
+
+        //only the page of the host change is sent with the next launch, and nothing is read twice
+        Transfers transfersA(mirrorA);
+        const int value = 1000;
+        mirrorA.write(10 * sizeof(int), &value, sizeof(int));
+        device.launchKernel(NUM_ITEMS, 64);
+        TEST_CHECK(transfersA.since(PAGE, 0));
+        mirrorC.read();
+        TEST_CHECK(c[10] == value + 1 + b[10] && c[11] == (int)(3 * 11 + 1));
+        mirrorC.read();
+        TEST_CHECK(transfersC.since(0, NUM_ITEMS * sizeof(int)));
+    }
+    device.freeMem();
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,110 @@
+#include "test.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace GPAPI;
+
+/*! MultiDeviceLaunch of vecAdd over 3 native devices, that stand in for the devices of a multi-GPU node.
+ One of them is made 10x slower (its bind sleeps for each item, much longer than vecAdd takes), so the weighted split should give it fewer items
+ */
+namespace {
+    const int NUM_DEVICES = 3;
+    const unsigned int NUM_ITEMS = 1200;
+    const size_t GRANULARITY = 64;
+    const int SLOW_DEVICE = 1;
+
+    struct BindVecAdd {
+        Device* slowDevice;
+        void operator()(Device& device, DeviceSlice& slice) {
+            device.addParam(*slice.buffers[0]);
+            device.addParam(*slice.buffers[1]);
+            device.addParam(*slice.buffers[2]);
+            device.addParam((unsigned int)slice.count);
+            std::this_thread::sleep_for(std::chrono::microseconds(slice.count * (&device == slowDevice ? 50 : 5)));
+        }
+    };
+
+    void checkSlices(const std::vector<DeviceSlice>& slices, size_t numItems) {
+        TEST_CHECK(slices.size() == NUM_DEVICES);
+        size_t offset = 0;
+        for (size_t i = 0; i < slices.size(); ++i) {
+            TEST_CHECK(slices[i].offset == offset);
+            offset += slices[i].count;
+            //slices end at whole work-groups, only the end of the range may cut one
+            TEST_CHECK(offset % GRANULARITY == 0 || offset == numItems);
+        }
+        TEST_CHECK(offset == numItems);
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices(NUM_DEVICES);
+    TEST_CHECK(devices.size() == NUM_DEVICES);
+    std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS), c(NUM_ITEMS);
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+        a[i] = i;
+        b[i] = 2 * i;
+    }
+
+    //the launch frees the buffers of the slices, so it goes before freeGPAPI
+    {
+        MultiDeviceLaunch launch(devices);
+        launch.addInput(&a[0], sizeof(int));
+        launch.addInput(&b[0], sizeof(int));
+        launch.addOutput(&c[0], sizeof(int));
+        launch.setGranularity(GRANULARITY);
+
+        //the first split is equal, up to the rounding to whole work-groups
+        const std::vector<DeviceSlice> first = launch.split(NUM_ITEMS);
+        checkSlices(first, NUM_ITEMS);
+        for (size_t i = 0; i < first.size(); ++i)
+            TEST_CHECK(first[i].count + GRANULARITY >= NUM_ITEMS / NUM_DEVICES && first[i].count <= NUM_ITEMS / NUM_DEVICES + GRANULARITY);
+
+        BindVecAdd bind = { devices[SLOW_DEVICE] };
+        for (int run = 0; run < 3; ++run) {
+            std::fill(c.begin(), c.end(), -1);
+            launch.run("vecAdd", NUM_ITEMS, bind);
+            int bad = 0;
+            for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+                bad += c[i] != (int)(3 * i + 1);
+            TEST_CHECK(bad == 0);
+        }
+
+        //the slow device gets less than its equal share after the measured runs
+        const std::vector<DeviceSlice> weighted = launch.split(NUM_ITEMS);
+        checkSlices(weighted, NUM_ITEMS);
+        TEST_CHECK(weighted[SLOW_DEVICE].count < NUM_ITEMS / NUM_DEVICES);
+        TEST_CHECK(launch.getWeights()[SLOW_DEVICE] < launch.getWeights()[0]);
+
+        //a weight of 0 gives a device no items
+        std::vector<double> weights(NUM_DEVICES, 1);
+        weights[2] = 0;
+        launch.setWeights(weights);
+        const std::vector<DeviceSlice> twoDevices = launch.split(NUM_ITEMS);
+        checkSlices(twoDevices, NUM_ITEMS);
+        TEST_CHECK(twoDevices[2].count == 0);
+
+        //with all items on one device its slice keeps its size, so the next runs reuse its buffers and take nothing from the memory pool
+        weights.assign(NUM_DEVICES, 0);
+        weights[0] = 1;
+        launch.setWeights(weights);
+        launch.run("vecAdd", NUM_ITEMS, bind);
+        const MemoryPool::Stats before = devices[0]->getMemoryPool().getStats();
+        for (int run = 0; run < 2; ++run) {
+            std::fill(c.begin(), c.end(), -1);
+            launch.run("vecAdd", NUM_ITEMS, bind);
+            int bad = 0;
+            for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+                bad += c[i] != (int)(3 * i + 1);
+            TEST_CHECK(bad == 0);
+        }
+        const MemoryPool::Stats after = devices[0]->getMemoryPool().getStats();
+        TEST_CHECK(after.hits == before.hits && after.misses == before.misses);
+    }
+
+    for (size_t i = 0; i < devices.size(); ++i)
+        devices[i]->freeMem();
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,96 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! 2D and 3D launches on the native target: every id function of each work item against the ids, that its position decodes to, transpose, and chooseLocalSize
+ */
+namespace {
+    /// Number of ints, that the kernel idProbe writes for each work item (ID_PROBE_FIELDS of kernel.cl)
+    const int FIELDS = 15;
+
+    /// Launches idProbe over global in groups of local and checks each value against the decode of the position of the item
+    void checkIds(Device& device, const NDRange& global, const NDRange& local) {
+        const size_t numItems = global.getTotal();
+        std::vector<int> out(numItems * FIELDS, -1);
+        Buffer buffer;
+        device.initBuffer(buffer, &out[0], out.size() * sizeof(int));
+        device.setKernel("idProbe");
+        device.addParam(buffer);
+        device.launchKernel(global, local).wait();
+        buffer.download(device.getQueue(), device.getContext(), &out[0], out.size() * sizeof(int));
+        device.freeMem();
+
+        size_t groups[NDRange::MAX_DIMS];
+        for (int dim = 0; dim < NDRange::MAX_DIMS; ++dim)
+            groups[dim] = global[dim] / local[dim];
+        int bad = 0;
+        for (size_t item = 0; item < numItems; ++item) {
+            const size_t ids[NDRange::MAX_DIMS] = { item % global[0], item / global[0] % global[1], item / (global[0] * global[1]) };
+            const int* fields = &out[item * FIELDS];
+            bool ok = fields[0] == (int)ids[0] && fields[1] == (int)(ids[0] % local[0]) && fields[2] == (int)(ids[0] / local[0]);
+            ok = ok && fields[3] == (int)global[0] && fields[4] == (int)local[0] && fields[5] == (int)groups[0];
+            for (int dim = 0; dim < NDRange::MAX_DIMS; ++dim) {
+                ok = ok && fields[6 + dim] == (int)ids[dim];
+                ok = ok && fields[9 + dim] == (int)(ids[dim] % local[dim]);
+                ok = ok && fields[12 + dim] == (int)(ids[dim] / local[dim]);
+            }
+            if (!ok && bad++ < 4)
+                printf("item %i of %ix%ix%i: globalID %i localID %i groupID %i globalSize %i localSize %i numGroups %i\n", (int)item,
+                       (int)global[0], (int)global[1], (int)global[2], fields[0], fields[1], fields[2], fields[3], fields[4], fields[5]);
+        }
+        TEST_CHECK(bad == 0);
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+
+    //1D keeps the linear ids, 2D and 3D give the ids in the first dimension, like a GPU
+    checkIds(device, NDRange(64), NDRange(8));
+    checkIds(device, NDRange(16, 4), NDRange(4, 2));
+    checkIds(device, NDRange(8, 6, 4), NDRange(2, 3, 2));
+
+    //transpose of a matrix, that is not square
+    const unsigned int width = 48, height = 20;
+    std::vector<float> in(width * height), out(width * height, -1.0f);
+    for (size_t i = 0; i < in.size(); ++i)
+        in[i] = (float)i;
+    {
+        Buffer bufferIn, bufferOut;
+        device.initBuffer(bufferIn, &in[0], in.size() * sizeof(float));
+        device.initBuffer(bufferOut, NULL, out.size() * sizeof(float));
+        device.setKernel("transpose");
+        device.addParam(bufferIn);
+        device.addParam(bufferOut);
+        device.addParam(width);
+        device.addParam(height);
+        device.launchKernel(NDRange(width, height), NDRange(16, 4)).wait();
+        bufferOut.download(device.getQueue(), device.getContext(), &out[0], out.size() * sizeof(float));
+        device.freeMem();
+    }
+    int wrong = 0;
+    for (unsigned int y = 0; y < height; ++y)
+        for (unsigned int x = 0; x < width; ++x)
+            wrong += out[x * height + y] != in[y * width + x];
+    TEST_CHECK(wrong == 0);
+
+    //the group is the largest power of 2 up to the target and the limit, the first dimension gets the preferred multiple first
+    const NDRange local1 = chooseLocalSize(NDRange(1000), 256, 1024, 32);
+    TEST_CHECK(local1.getDims() == 1 && local1[0] == 256);
+    const NDRange local2 = chooseLocalSize(NDRange(1024, 1024), 256, 1024, 32);
+    TEST_CHECK(local2.getDims() == 2 && local2[0] == 32 && local2[1] == 8);
+    const NDRange local3 = chooseLocalSize(NDRange(64, 64, 64), 512, 256, 8);
+    TEST_CHECK(local3.getDims() == 3 && local3.getTotal() == 256 && local3[0] >= 8);
+    //no dimension is bigger than its global size needs
+    const NDRange small = chooseLocalSize(NDRange(5, 3), 256, 256, 32);
+    TEST_CHECK(small[0] == 8 && small[1] == 4);
+    const NDRange tooSmall = chooseLocalSize(NDRange(3), 256, 256, 1);
+    TEST_CHECK(tooSmall[0] == 4);
+    //targets, that are not powers of 2, are rounded down
+    TEST_CHECK(chooseLocalSize(NDRange(4096), 200, 1024, 1)[0] == 128);
+
+    device.freeMem();
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,51 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! parallelFor, that initGPAPI runs the context creation and the builds with: each index is run exactly once, on no more threads than there are cores, and all calls are done when it returns
+ */
+namespace {
+    const int COUNT = 1000;
+
+    struct Task {
+        std::vector<std::atomic<int> >* calls;
+        std::atomic<int>* running;
+        std::atomic<int>* mostRunning;
+
+        void operator()(int i) {
+            const int now = ++*running;
+            int most = mostRunning->load();
+            while (now > most && !mostRunning->compare_exchange_weak(most, now)) {
+            }
+            ++(*calls)[i];
+            //a little work, so the threads overlap
+            volatile int sum = 0;
+            for (int k = 0; k < 1000; ++k)
+                sum += k;
+            --*running;
+        }
+    };
+}
+
+int main() {
+    std::vector<std::atomic<int> > calls(COUNT);
+    for (int i = 0; i < COUNT; ++i)
+        calls[i] = 0;
+    std::atomic<int> running(0), mostRunning(0);
+    Task task = { &calls, &running, &mostRunning };
+
+    parallelFor(COUNT, task);
+    int bad = 0;
+    for (int i = 0; i < COUNT; ++i)
+        bad += calls[i] != 1;
+    TEST_CHECK(bad == 0);
+    TEST_CHECK(running == 0);
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    TEST_CHECK(mostRunning >= 1 && mostRunning <= cores);
+
+    //nothing to do, and a single call
+    parallelFor(0, task);
+    parallelFor(1, task);
+    TEST_CHECK(calls[0] == 2 && calls[1] == 1);
+    return test::result();
+}
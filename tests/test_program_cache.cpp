@@ -0,0 +1,136 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! ProgramCache with a fake compiler: the second cache on the directory (as a new process would open it) loads the entry without compiling,
+ and corrupted, truncated, resized or stale entries are compiled again. Runs in program_cache_test under the working directory
+ */
+namespace {
+    const char* DIRECTORY = "program_cache_test";
+
+    /// Stands in for clBuildProgram / nvrtcCompileProgram, counts its calls
+    struct FakeCompiler {
+        FakeCompiler(const std::string& result):calls(0), output(result) {
+        }
+
+        void operator()(std::vector<char>& binary) {
+            ++calls;
+            binary.assign(output.begin(), output.end());
+        }
+
+        int calls;
+        std::string output;
+    };
+
+    /// \return Paths of the cache entries in DIRECTORY
+    std::vector<std::string> listEntries() {
+        const std::vector<std::string> names = listDirectory(DIRECTORY);
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i].find(".gpapibin") != std::string::npos)
+                paths.push_back(DIRECTORY + ("/" + names[i]));
+        }
+        return paths;
+    }
+
+    std::string getEntryPath(const std::string& key) {
+        char name[64];
+        snprintf(name, sizeof(name), "/%016llx.gpapibin", ProgramCache::hash(key.data(), key.size()));
+        return DIRECTORY + std::string(name);
+    }
+
+    std::vector<char> readFile(const std::string& path) {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& path, const std::vector<char>& data) {
+        std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+        file.write(data.empty() ? NULL : &data[0], data.size());
+    }
+
+    /// \return Number of compiles of a get for key, that should give the binary of compiler
+    int compilesOfGet(ProgramCache& cache, const std::string& key, const std::string& binary) {
+        FakeCompiler compiler(binary);
+        std::vector<char> result;
+        cache.get(key, result, compiler);
+        TEST_CHECK(std::string(result.begin(), result.end()) == binary);
+        return compiler.calls;
+    }
+}
+
+int main() {
+    makeDirectory(DIRECTORY);
+    const std::vector<std::string> old = listEntries();
+    for (size_t i = 0; i < old.size(); ++i)
+        remove(old[i].c_str());
+
+    const std::string binary = "BINARY-FOR-FAKE-GPU";
+    const std::string key = ProgramCache::makeKey("kernel source", "-O3", "Fake GPU", "driver 1.0");
+    const std::string path = getEntryPath(key);
+
+    //parts are length-prefixed, so other splits of the same text are other keys
+    TEST_CHECK(ProgramCache::makeKey("ab", "c", "d", "e") != ProgramCache::makeKey("a", "bc", "d", "e"));
+
+    {
+        ProgramCache first(DIRECTORY);
+        TEST_CHECK(compilesOfGet(first, key, binary) == 1);
+    }
+    {
+        ProgramCache second(DIRECTORY);
+        TEST_CHECK(compilesOfGet(second, key, binary) == 0);
+        //another driver version is another entry
+        TEST_CHECK(compilesOfGet(second, ProgramCache::makeKey("kernel source", "-O3", "Fake GPU", "driver 2.0"), "OTHER") == 1);
+    }
+
+    ProgramCache cache(DIRECTORY);
+    const std::vector<char> good = readFile(path);
+    TEST_CHECK(good.size() > binary.size());
+
+    //a flipped byte of the data fails the checksum
+    std::vector<char> corrupted = good;
+    corrupted[corrupted.size() - 3] ^= 1;
+    writeFile(path, corrupted);
+    TEST_CHECK(compilesOfGet(cache, key, binary) == 1);
+    TEST_CHECK(compilesOfGet(cache, key, binary) == 0);
+
+    //a truncated file
+    writeFile(path, std::vector<char>(good.begin(), good.begin() + 20));
+    TEST_CHECK(compilesOfGet(cache, key, binary) == 1);
+
+    //a huge size in the header is not allocated, it does not match the file
+    std::vector<char> resized = good;
+    memset(&resized[16], 0x7f, 8);
+    writeFile(path, resized);
+    TEST_CHECK(compilesOfGet(cache, key, binary) == 1);
+
+    //a stale entry of an older file layout (another magic)
+    std::vector<char> stale = good;
+    stale[6] = '0';
+    writeFile(path, stale);
+    TEST_CHECK(compilesOfGet(cache, key, binary) == 1);
+    TEST_CHECK(readFile(path) == good);
+
+    //the size cap evicts the least recently used entries, but never the one just stored
+    ProgramCache small(DIRECTORY, 10000);
+    for (int i = 0; i < 5; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "big%i", i);
+        small.store(name, std::vector<char>(3000, (char)i));
+    }
+    size_t total = 0;
+    const std::vector<std::string> entries = listEntries();
+    for (size_t i = 0; i < entries.size(); ++i)
+        total += readFile(entries[i]).size();
+    TEST_CHECK(total <= 10000);
+    std::vector<char> newest;
+    TEST_CHECK(small.load("big4", newest) && newest.size() == 3000);
+
+    //an empty directory disables the cache
+    ProgramCache disabled;
+    TEST_CHECK(!disabled.isEnabled());
+    TEST_CHECK(compilesOfGet(disabled, key, binary) == 1);
+    TEST_CHECK(compilesOfGet(disabled, key, binary) == 1);
+
+    return test::result();
+}
@@ -0,0 +1,73 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! Native work-groups: a launch runs its global size rounded up to whole work-groups, and no work item past that.
+ vecAdd uses FOR_EACH_ITEM, so the group sizes also check that its loop stops at the end of each chunk of groups.
+ groupSum reduces each group in SHARED memory with MEMORY_BARRIER, so its sums are only right if no work item passes a barrier before the others reach it
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 1000;
+
+    /// Launches vecAdd over NUM_ITEMS items with n twice as big, so only the items of the launch, rounded up to whole groups, may write c
+    void checkGlobalSize(Device& device, unsigned int groupSize) {
+        const unsigned int n = 2 * NUM_ITEMS;
+        std::vector<int> a(n), b(n, 1), c(n, -1);
+        for (unsigned int i = 0; i < n; ++i)
+            a[i] = i;
+        const size_t bytes = n * sizeof(int);
+        device.setKernel("vecAdd");
+        device.addParam(&a[0], bytes);
+        device.addParam(&b[0], bytes);
+        Buffer& result = device.addParam(&c[0], bytes);
+        device.addParam(n);
+        device.launchKernel(NUM_ITEMS, groupSize);
+        device.wait();
+        result.download(device.getQueue(), device.getContext(), &c[0], bytes);
+        const unsigned int launched = (NUM_ITEMS + groupSize - 1) / groupSize * groupSize;
+        int bad = 0, outside = 0;
+        for (unsigned int i = 0; i < launched; ++i)
+            bad += c[i] != (int)i + 2;
+        for (unsigned int i = launched; i < n; ++i)
+            outside += c[i] != -1;
+        TEST_CHECK(bad == 0);
+        TEST_CHECK(outside == 0);
+        device.freeMem();
+    }
+
+    /// Launches groupSum over NUM_ITEMS items. The last group is not full, its items past n add 0
+    void checkGroupSum(Device& device, unsigned int groupSize) {
+        const unsigned int numGroups = (NUM_ITEMS + groupSize - 1) / groupSize;
+        std::vector<int> a(NUM_ITEMS), sums(numGroups);
+        for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+            a[i] = (int)(i % 7) - 3;
+        device.setKernel("groupSum");
+        device.addParam(&a[0], NUM_ITEMS * sizeof(int));
+        Buffer& result = device.addParam(NULL, numGroups * sizeof(int));
+        device.addParam(NUM_ITEMS);
+        device.launchKernel(numGroups * groupSize, groupSize);
+        device.wait();
+        result.download(device.getQueue(), device.getContext(), &sums[0], numGroups * sizeof(int));
+        int bad = 0;
+        for (unsigned int g = 0; g < numGroups; ++g) {
+            int expected = 0;
+            for (unsigned int i = g * groupSize; i < std::min(NUM_ITEMS, (g + 1) * groupSize); ++i)
+                expected += a[i];
+            bad += sums[g] != expected;
+        }
+        TEST_CHECK(bad == 0);
+        device.freeMem();
+    }
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices();
+    const unsigned int groupSizes[] = { 1, 7, 64, 1000, 1024 };
+    for (size_t i = 0; i < sizeof(groupSizes) / sizeof(groupSizes[0]); ++i)
+        checkGlobalSize(*devices[0], groupSizes[i]);
+    //groupSum halves the group in each step, so its groups are powers of 2 up to its SHARED array of 256
+    for (unsigned int groupSize = 1; groupSize <= 256; groupSize *= 2)
+        checkGroupSum(*devices[0], groupSize);
+    freeGPAPI(devices);
+    return test::result();
+}
@@ -0,0 +1,63 @@
+#include "test.h"
+
+using namespace GPAPI;
+
+/*! Zero-copy buffers on the native target: the kernel reads and writes the caller's arrays, nothing is allocated from the memory pool, and a download into the wrapped array does not copy
+ */
+namespace {
+    const unsigned int NUM_ITEMS = 1000;
+}
+
+int main() {
+    std::vector<Device*> devices = test::initDevices();
+    Device& device = *devices[0];
+    const MemoryPool::Stats& stats = device.getMemoryPool().getStats();
+    TEST_CHECK(device.isHostMemoryShared());
+    //init stores the vendor and type of the device
+    TEST_CHECK(device.getVendor() == InitParams::VendorParams::UnknownVendor);
+    TEST_CHECK(device.getType() == InitParams::VendorParams::UnkownDevice);
+
+    const size_t bytes = NUM_ITEMS * sizeof(int);
+    std::vector<int> a(NUM_ITEMS), b(NUM_ITEMS), c(NUM_ITEMS, -1);
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i) {
+        a[i] = i;
+        b[i] = 5 * i;
+    }
+    const std::vector<int> a0 = a, b0 = b;
+
+    device.setKernel("vecAdd");
+    Buffer& bufferA = device.addParam(&a[0], bytes, true);
+    Buffer& bufferB = device.addParam(&b[0], bytes, true);
+    Buffer& bufferC = device.addParam(&c[0], bytes, true);
+    device.addParam(NUM_ITEMS);
+    TEST_CHECK(bufferA.get() == &a[0] && bufferB.get() == &b[0] && bufferC.get() == &c[0]);
+    TEST_CHECK(stats.hits == 0 && stats.misses == 0 && stats.bytesInUse == 0);
+
+    //the kernel writes c itself, the download only waits for it
+    device.launchKernel(NUM_ITEMS, 64);
+    bufferC.download(device.getQueue(), device.getContext(), &c[0], bytes);
+    int bad = 0;
+    for (unsigned int i = 0; i < NUM_ITEMS; ++i)
+        bad += c[i] != (int)(6 * i + 1);
+    TEST_CHECK(bad == 0);
+    TEST_CHECK(a == a0 && b == b0);
+
+    //a download to another array still copies
+    std::vector<int> copy(NUM_ITEMS, 0);
+    bufferC.download(device.getQueue(), device.getContext(), &copy[0], bytes);
+    TEST_CHECK(copy == c);
+
+    //an async download to the wrapped array keeps the order of the queue
+    c.assign(NUM_ITEMS, -1);
+    device.launchKernel(NUM_ITEMS, 64);
+    bufferC.downloadAsync(device.getQueue(), device.getContext(), &c[0], bytes).wait();
+    TEST_CHECK(c == copy);
+
+    //freeMem leaves the caller's memory alone
+    device.freeMem();
+    TEST_CHECK(a == a0 && b == b0 && c == copy);
+    TEST_CHECK(stats.bytesCached == 0);
+
+    freeGPAPI(devices);
+    return test::result();
+}